@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -24,14 +24,22 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 
 SOURCES += \
+        agentprotocol.cpp \
         copier.cpp \
+        flusher.cpp \
+        logmodel.cpp \
         main.cpp \
         mainwindow.cpp
 
 HEADERS += \
+        agentprotocol.h \
         copier.h \
+        flusher.h \
+        logmodel.h \
         mainwindow.h
 
+win32: LIBS += -lpsapi
+
 FORMS += \
         mainwindow.ui
 
@@ -39,4 +47,5 @@ DISTFILES += \
     licence.txt \
     source.siba \
     target.siba \
+    siba-agent.pro \
     README.md
@@ -0,0 +1,526 @@
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <algorithm>
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#endif
+
+#include "agent.h"
+#include "agentprotocol.h"
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file agent.cpp
+ *
+ * \brief Agent and AgentSession classes implemenation.
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief Takes ownership of the connection.
+ * \param device Socket connected to the sender.
+ * \param root Target directory.
+ * \param token Access token, the sender must present the same token.
+ * \param parent Parent object.
+ */
+AgentSession::AgentSession(QIODevice *device, QString root, QString token, QObject *parent) : QObject(parent)
+{
+    _device = device;
+    _device->setParent(this);
+    _root = root;
+    _token = token;
+
+    connect(_device, &QIODevice::readyRead, this, &AgentSession::readMessages);
+}
+
+
+/*!
+ * \brief Removes an incompletely received file.
+ */
+AgentSession::~AgentSession()
+{
+    if (_file.isOpen()) {
+        _file.close();
+        _file.remove();
+    }
+}
+
+
+/*!
+ * \brief Processes all complete messages received from the sender.
+ *
+ * \remark The connection is closed after a protocol error.
+ */
+void AgentSession::readMessages()
+{
+    QByteArray message;
+
+    while (_device->isOpen() && AgentProtocol::readMessage(_device, message)) {
+        if (!processMessage(message)) {
+            _device->close();
+            return;
+        }
+    }
+}
+
+
+/*!
+ * \brief Dispatches one message.
+ * \param message Message payload.
+ * \return false if the message is invalid
+ */
+bool AgentSession::processMessage(const QByteArray &message)
+{
+    QDataStream in(message);
+    quint8 type;
+    bool result;
+
+    in.setVersion(AgentProtocol::STREAMVERSION);
+    in >> type;
+    if (in.status() != QDataStream::Ok) return false;
+
+    if (type == AgentProtocol::Hello) return processHello(in);
+    if (!_accepted) return false;
+
+    switch (type) {
+    case AgentProtocol::Directory: result = processDirectory(in); break;
+    case AgentProtocol::File: result = processFile(in); break;
+    case AgentProtocol::Data: result = processData(in); break;
+    case AgentProtocol::FileEnd: result = processFileEnd(in); break;
+    case AgentProtocol::Link: result = processLink(in); break;
+    case AgentProtocol::End: result = processEnd(); break;
+    default: result = false;
+    }
+
+    return result && in.status() == QDataStream::Ok;
+}
+
+
+/*!
+ * \brief Checks the protocol version, the access token and the target directory.
+ * \param in Message fields.
+ * \return true if the sender is accepted
+ */
+bool AgentSession::processHello(QDataStream &in)
+{
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    quint32 version;
+    QString token;
+    bool validate;
+    QString error;
+
+    in >> version >> token >> validate;
+
+    if (in.status() != QDataStream::Ok || version != AgentProtocol::VERSION)
+        error = "Unsupported protocol version";
+    else if (token != _token)
+        error = "Invalid access token";
+    else if (validate && !QFile::exists(_root + "/" + TARGETDIRID))
+        error = "Invalid target directory";
+
+    _accepted = error.isEmpty();
+
+    out.setVersion(AgentProtocol::STREAMVERSION);
+    out << quint8(AgentProtocol::Welcome) << _accepted << error;
+    sendMessage(reply);
+    return _accepted;
+}
+
+
+/*!
+ * \brief Compares a batch of source entries with the target directory.
+ * \param in Message fields.
+ * \return false if the message is invalid
+ *
+ * Missing directories are created and new or modified files are requested.
+ * After the last batch of a directory, target entries missing in the source are removed.
+ */
+bool AgentSession::processDirectory(QDataStream &in)
+{
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    quint64 batch;
+    QString path;
+    bool last;
+    QStringList names;
+    QList<bool> directories;
+    QList<qint64> modified;
+    QStringList needNames;
+    QList<bool> needOverwrite;
+    QString directory, targetFN;
+
+    in >> batch >> path >> last >> names >> directories >> modified;
+    if (in.status() != QDataStream::Ok) return false;
+    if (!AgentProtocol::isValidPath(path)) return false;
+    if (names.size() != directories.size() || names.size() != modified.size()) return false;
+
+    if (_listingPath != path) {
+        _listingPath = path;
+        _listingHashes.clear();
+    }
+
+    directory = _root + path;
+    for (int i = 0; i < names.size(); i++) {
+        if (!AgentProtocol::isValidName(names[i])) return false;
+        _listingHashes.append(nameHash(names[i]));
+
+        targetFN = directory + "/" + names[i];
+        QFileInfo targetFileInfo(targetFN);
+        if (directories[i]) {
+            if (!targetFileInfo.exists()) {
+                if (QDir().mkdir(targetFN)) _newDirectories++;
+                else sendError("Cannot create directory " + targetFN);
+            }
+        }
+        else if (!targetFileInfo.exists()) {
+            needNames << names[i];
+            needOverwrite << false;
+        }
+        else if (targetFileInfo.lastModified().toMSecsSinceEpoch() < modified[i]) {
+            needNames << names[i];
+            needOverwrite << true;
+        }
+    }
+
+    if (last) {
+        std::sort(_listingHashes.begin(), _listingHashes.end());
+        removeDirectoryEntries(directory);
+        _listingPath.clear();
+        _listingHashes.clear();
+        _listingHashes.squeeze();
+    }
+
+    out.setVersion(AgentProtocol::STREAMVERSION);
+    out << quint8(AgentProtocol::Need) << batch << needNames << needOverwrite;
+    sendMessage(reply);
+    return true;
+}
+
+
+/*!
+ * \brief Removes files and subdirectories missing in the listed source directory.
+ * \param directory Full path to target directory.
+ *
+ * \remark An entry whose hash collides with a source name is kept, no source entry is ever removed.
+ */
+void AgentSession::removeDirectoryEntries(QString directory)
+{
+    QDirIterator targetIterator(directory, QDir::Filter::Hidden | QDir::Filter::Files | QDir::Filter::AllDirs | QDir::Filter::NoDotAndDotDot);
+    QString targetFN;
+
+    while (targetIterator.hasNext()) {
+        targetIterator.next();
+        QFileInfo targetFileInfo = targetIterator.fileInfo();
+        targetFN = targetFileInfo.fileName();
+        if (std::binary_search(_listingHashes.constBegin(), _listingHashes.constEnd(), nameHash(targetFN))) continue;
+        if (targetFileInfo.isFile() && (targetFN == SOURCEDIRID || targetFN == TARGETDIRID)) continue;
+
+        QFile(targetFileInfo.filePath()).setPermissions(QFile::ReadOther | QFile::WriteOther);
+        if (targetFileInfo.isFile()) {
+            QFile::remove(targetFileInfo.filePath());
+            if (QFile::exists(targetFileInfo.filePath())) {
+                sendError("Cannot remove file " + targetFileInfo.filePath());
+            }
+            _removedFilesSize += targetFileInfo.size();
+            _removedFiles++;
+        }
+        else {
+            QDir(targetFileInfo.filePath()).removeRecursively();
+            _removedDirectories++;
+        }
+    }
+}
+
+
+/*!
+ * \brief Returns the 64-bit FNV-1a hash of a file name.
+ * \param name File name.
+ */
+quint64 AgentSession::nameHash(const QString &name)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+
+    for (int i = 0; i < name.size(); i++) {
+        hash ^= name[i].unicode();
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+
+/*!
+ * \brief Starts receiving a file, an existing file is replaced.
+ * \param in Message fields.
+ * \return false if the message is invalid
+ *
+ * On Linux, a file that is not sparse is preallocated to its size to reduce fragmentation.
+ */
+bool AgentSession::processFile(QDataStream &in)
+{
+    QString path;
+    qint64 size;
+    qint32 permissions;
+    bool sparse;
+    QString targetFN;
+
+    in >> path >> size >> permissions >> sparse;
+    if (in.status() != QDataStream::Ok) return false;
+    if (path.isEmpty() || !AgentProtocol::isValidPath(path) || size < 0) return false;
+
+    if (_file.isOpen()) {
+        _file.close();
+        _file.remove();
+    }
+
+    targetFN = _root + path;
+    if (QFile::exists(targetFN)) {
+        QFile(targetFN).setPermissions(QFile::ReadOther | QFile::WriteOther);
+        QFile::remove(targetFN);
+    }
+
+    _file.setFileName(targetFN);
+    _filePermissions = QFile::Permissions(permissions);
+    if (!_file.open(QIODevice::WriteOnly)) {
+        sendError("Cannot copy file " + targetFN);
+        return true;
+    }
+
+#if defined(Q_OS_LINUX)
+    // failure is not an error, e.g. the file system does not support preallocation
+    if (!sparse && 0 < size) fallocate(_file.handle(), 0, 0, size);
+#else
+    Q_UNUSED(sparse)
+#endif
+    return true;
+}
+
+
+/*!
+ * \brief Writes a block of file data at its offset, skipped ranges remain holes.
+ * \param in Message fields.
+ * \return false if the message is invalid
+ */
+bool AgentSession::processData(QDataStream &in)
+{
+    qint64 offset;
+    QByteArray block;
+
+    in >> offset >> block;
+    if (in.status() != QDataStream::Ok || offset < 0) return false;
+    if (!_file.isOpen()) return true;
+
+    if ((_file.pos() != offset && !_file.seek(offset)) || _file.write(block) != block.size()) {
+        sendError("Cannot copy file " + _file.fileName());
+        _file.close();
+        _file.remove();
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Completes the received file, an incomplete file is removed.
+ * \param in Message fields.
+ * \return false if the message is invalid
+ *
+ * The file is truncated to its final size, which also creates a trailing hole of a sparse file.
+ */
+bool AgentSession::processFileEnd(QDataStream &in)
+{
+    bool complete;
+    qint64 size;
+
+    in >> complete >> size;
+    if (in.status() != QDataStream::Ok || size < 0) return false;
+    if (!_file.isOpen()) return true;
+
+    if (complete && !_file.resize(size)) complete = false;
+    _file.close();
+    if (complete && _file.error() == QFileDevice::NoError) {
+        _file.setPermissions(_filePermissions);
+    }
+    else {
+        _file.remove();
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Creates a hard link to a file received earlier, an existing file is replaced.
+ * \param in Message fields.
+ * \return false if the message is invalid
+ *
+ * \remark The file is copied if the link cannot be created.
+ */
+bool AgentSession::processLink(QDataStream &in)
+{
+    QString path, linkPath;
+    QString targetFN, linkTarget;
+    bool linked = false;
+
+    in >> path >> linkPath;
+    if (in.status() != QDataStream::Ok) return false;
+    if (path.isEmpty() || !AgentProtocol::isValidPath(path)) return false;
+    if (linkPath.isEmpty() || !AgentProtocol::isValidPath(linkPath)) return false;
+
+    targetFN = _root + path;
+    linkTarget = _root + linkPath;
+    if (QFile::exists(targetFN)) {
+        QFile(targetFN).setPermissions(QFile::ReadOther | QFile::WriteOther);
+        QFile::remove(targetFN);
+    }
+
+#if defined(Q_OS_UNIX)
+    linked = ::link(QFile::encodeName(linkTarget).constData(), QFile::encodeName(targetFN).constData()) == 0;
+#endif
+    if (!linked && !QFile::copy(linkTarget, targetFN)) {
+        sendError("Cannot link file " + targetFN);
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Replies with the statistics of the agent side.
+ * \return true
+ */
+bool AgentSession::processEnd()
+{
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+
+    out.setVersion(AgentProtocol::STREAMVERSION);
+    out << quint8(AgentProtocol::Summary) << _removedFiles << _removedFilesSize << _newDirectories << _removedDirectories;
+    sendMessage(reply);
+    return true;
+}
+
+
+/*!
+ * \brief Sends a message to the sender.
+ * \param message Message payload.
+ */
+void AgentSession::sendMessage(const QByteArray &message)
+{
+    AgentProtocol::writeMessage(_device, message);
+}
+
+
+/*!
+ * \brief Sends an error message to the sender.
+ * \param message Error message.
+ */
+void AgentSession::sendError(QString message)
+{
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+
+    out.setVersion(AgentProtocol::STREAMVERSION);
+    out << quint8(AgentProtocol::Error) << message;
+    sendMessage(reply);
+}
+
+
+
+
+/*!
+ * \brief Agent receiving backups into the target directory.
+ * \param root Target directory.
+ * \param token Access token.
+ * \param parent Parent object.
+ */
+Agent::Agent(QString root, QString token, QObject *parent) : QObject(parent)
+{
+    _root = root;
+    _token = token;
+}
+
+
+/*!
+ * \brief Listens for TCP connections.
+ * \param address Listening address.
+ * \param port TCP port.
+ * \return true if the server is listening
+ */
+bool Agent::listen(QHostAddress address, quint16 port)
+{
+    _tcpServer = new QTcpServer(this);
+    connect(_tcpServer, &QTcpServer::newConnection, this, &Agent::newTcpConnection);
+    return _tcpServer->listen(address, port);
+}
+
+
+/*!
+ * \brief Listens for local socket connections, only the user running the agent can connect.
+ * \param socketName Name or full path of the local socket.
+ * \return true if the server is listening
+ */
+bool Agent::listen(QString socketName)
+{
+    _localServer = new QLocalServer(this);
+    connect(_localServer, &QLocalServer::newConnection, this, &Agent::newLocalConnection);
+    _localServer->setSocketOptions(QLocalServer::UserAccessOption);
+    QLocalServer::removeServer(socketName);
+    return _localServer->listen(socketName);
+}
+
+
+/*!
+ * \brief Returns the last error of the server.
+ */
+QString Agent::errorString() const
+{
+    if (_tcpServer != nullptr) return _tcpServer->errorString();
+    if (_localServer != nullptr) return _localServer->errorString();
+    return QString();
+}
+
+
+/*!
+ * \brief Starts a session for each new TCP connection.
+ */
+void Agent::newTcpConnection()
+{
+    while (_tcpServer->hasPendingConnections()) {
+        QTcpSocket *socket = _tcpServer->nextPendingConnection();
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        AgentSession *session = new AgentSession(socket, _root, _token, this);
+        connect(socket, &QTcpSocket::disconnected, session, &QObject::deleteLater);
+    }
+}
+
+
+/*!
+ * \brief Starts a session for each new local socket connection.
+ */
+void Agent::newLocalConnection()
+{
+    while (_localServer->hasPendingConnections()) {
+        QLocalSocket *socket = _localServer->nextPendingConnection();
+        AgentSession *session = new AgentSession(socket, _root, _token, this);
+        connect(socket, &QLocalSocket::disconnected, session, &QObject::deleteLater);
+    }
+}
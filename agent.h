@@ -0,0 +1,111 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include <QObject>
+#include <QFile>
+#include <QVector>
+#include <QHostAddress>
+
+class QDataStream;
+class QIODevice;
+class QTcpServer;
+class QLocalServer;
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file agent.h
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief The AgentSession class, one backup received by the agent.
+ *
+ * The session compares directory listings of the sender with the target directory,
+ * removes files and directories missing in the source and requests new and modified files.
+ *
+ * \remark Target entries missing in the source are removed after the last batch of a directory,
+ * so the names of the listed directory are kept until then as 64-bit hashes,
+ * 8 bytes per entry of the largest directory.
+ */
+class AgentSession : public QObject
+{
+    Q_OBJECT
+
+private:
+    const char* SOURCEDIRID = "source.siba"; //!< the default name of source directory validation file
+    const char* TARGETDIRID = "target.siba"; //!< the default name of target directory validation file
+
+    QIODevice *_device; //!< connection to the sender
+    QString _root; //!< target directory
+    QString _token; //!< access token
+    bool _accepted = false; //!< the sender passed the handshake
+
+    QString _listingPath; //!< relative path of the directory being listed
+    QVector<quint64> _listingHashes; //!< hashes of source names of the directory being listed, sorted after the last batch
+
+    QFile _file; //!< file being received
+    QFile::Permissions _filePermissions; //!< permissions of the file being received
+
+    qint64 _removedFiles = 0; //!< number of removed files
+    qint64 _removedFilesSize = 0; //!< size of removed files in bytes
+    qint64 _newDirectories = 0; //!< number of new directories
+    qint64 _removedDirectories = 0; //!< number of removed directories
+
+public:
+    explicit AgentSession(QIODevice *device, QString root, QString token, QObject *parent=nullptr);
+    virtual ~AgentSession();
+
+protected:
+    bool processMessage(const QByteArray &message);
+    bool processHello(QDataStream &in);
+    bool processDirectory(QDataStream &in);
+    bool processFile(QDataStream &in);
+    bool processData(QDataStream &in);
+    bool processFileEnd(QDataStream &in);
+    bool processLink(QDataStream &in);
+    bool processEnd();
+
+    void removeDirectoryEntries(QString directory);
+    static quint64 nameHash(const QString &name);
+    void sendMessage(const QByteArray &message);
+    void sendError(QString message);
+
+public slots:
+    void readMessages();
+};
+
+
+/*!
+ * \brief The Agent class, receives backups over TCP or a local socket.
+ */
+class Agent : public QObject
+{
+    Q_OBJECT
+
+private:
+    QString _root; //!< target directory
+    QString _token; //!< access token
+    QTcpServer *_tcpServer = nullptr; //!< TCP server
+    QLocalServer *_localServer = nullptr; //!< local socket server
+
+public:
+    explicit Agent(QString root, QString token, QObject *parent=nullptr);
+
+    bool listen(QHostAddress address, quint16 port);
+    bool listen(QString socketName);
+    QString errorString() const;
+
+public slots:
+    void newTcpConnection();
+    void newLocalConnection();
+};
+
+#endif // AGENT_H
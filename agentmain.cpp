@@ -0,0 +1,78 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QHostAddress>
+
+#include "agent.h"
+#include "agentprotocol.h"
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file agentmain.cpp
+ *
+ * \brief siba-agent, receives backups sent by SiBa into a target directory.
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ *
+ * siba-agent [--bind address] [--port port] [--socket path] [--token token] target
+ *
+ * The agent listens on 127.0.0.1 by default. The access token defaults to
+ * the SIBA_AGENT_TOKEN environment variable, it is required in every mode.
+ * A local socket is accessible only by the user running the agent.
+ * *****************************************************************
+ */
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("siba-agent");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Receives backups sent by SiBa into a target directory.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("target", "Target directory.");
+
+    QCommandLineOption bindOption("bind", "Listening address.", "address", "127.0.0.1");
+    QCommandLineOption portOption("port", "TCP port.", "port", QString::number(AgentProtocol::DEFAULTPORT));
+    QCommandLineOption socketOption("socket", "Listen on a local socket instead of TCP.", "path");
+    QCommandLineOption tokenOption("token", "Access token.", "token", QString::fromLocal8Bit(qgetenv("SIBA_AGENT_TOKEN")));
+    parser.addOption(bindOption);
+    parser.addOption(portOption);
+    parser.addOption(socketOption);
+    parser.addOption(tokenOption);
+    parser.process(a);
+
+    if (parser.positionalArguments().size() != 1) parser.showHelp(1);
+
+    QFileInfo target(parser.positionalArguments().first());
+    if (!target.isDir()) {
+        qCritical("Target directory does not exist");
+        return 1;
+    }
+
+    // without a token, any host or local user reaching the agent could modify the target directory
+    QString token = parser.value(tokenOption);
+    if (token.isEmpty()) {
+        qCritical("Access token is required, use --token or SIBA_AGENT_TOKEN");
+        return 1;
+    }
+
+    Agent agent(target.absoluteFilePath(), token);
+    bool listening;
+    if (parser.isSet(socketOption))
+        listening = agent.listen(parser.value(socketOption));
+    else
+        listening = agent.listen(QHostAddress(parser.value(bindOption)), quint16(parser.value(portOption).toUInt()));
+
+    if (!listening) {
+        qCritical("%s", qPrintable(agent.errorString()));
+        return 1;
+    }
+
+    return a.exec();
+}
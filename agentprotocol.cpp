@@ -0,0 +1,93 @@
+#include <QIODevice>
+#include <QStringList>
+#include <QtEndian>
+
+#include "agentprotocol.h"
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file agentprotocol.cpp
+ *
+ * \brief AgentProtocol class implemenation.
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief Writes a framed message to the device.
+ * \param device Socket connected to the other side.
+ * \param message Message payload.
+ */
+void AgentProtocol::writeMessage(QIODevice *device, const QByteArray &message)
+{
+    uchar size[4];
+
+    qToBigEndian<quint32>(quint32(message.size()), size);
+    device->write(reinterpret_cast<const char*>(size), sizeof(size));
+    device->write(message);
+}
+
+
+/*!
+ * \brief Reads a complete framed message from the device, does not block.
+ * \param device Socket connected to the other side.
+ * \param message Receives the message payload.
+ * \return false if a complete message is not available yet
+ *
+ * \remark A message larger than MESSAGELIMIT is returned empty, the connection should be closed.
+ */
+bool AgentProtocol::readMessage(QIODevice *device, QByteArray &message)
+{
+    uchar size[4];
+    quint32 messageSize;
+
+    if (device->bytesAvailable() < qint64(sizeof(size))) return false;
+    device->peek(reinterpret_cast<char*>(size), sizeof(size));
+    messageSize = qFromBigEndian<quint32>(size);
+
+    if (MESSAGELIMIT < messageSize) {
+        message.clear();
+        return true;
+    }
+
+    if (device->bytesAvailable() < qint64(sizeof(size)) + messageSize) return false;
+    device->read(sizeof(size));
+    message = device->read(messageSize);
+    return true;
+}
+
+
+/*!
+ * \brief Checks a file or directory name received from the other side.
+ * \param name File or directory name.
+ * \return true if the name does not leave its directory
+ */
+bool AgentProtocol::isValidName(const QString &name)
+{
+    return !name.isEmpty() && name != "." && name != ".."
+            && !name.contains('/') && !name.contains('\\') && !name.contains(QChar(0));
+}
+
+
+/*!
+ * \brief Checks a path relative to the target directory.
+ * \param path Empty string for the target directory, otherwise "/" followed by names separated by "/".
+ * \return true if the path does not leave the target directory
+ */
+bool AgentProtocol::isValidPath(const QString &path)
+{
+    if (path.isEmpty()) return true;
+    if (!path.startsWith('/')) return false;
+
+    foreach (QString name, path.mid(1).split('/')) {
+        if (!isValidName(name)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef AGENTPROTOCOL_H
+#define AGENTPROTOCOL_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QString>
+
+class QIODevice;
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file agentprotocol.h
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief The AgentProtocol class, messages exchanged between Copier and siba-agent.
+ *
+ * Every message is a 32-bit big-endian length followed by the payload.
+ * The payload starts with the message type, the fields are serialized by QDataStream.
+ *
+ * The sender lists source directories in batches and the agent replies with the files
+ * it needs, the sender does not wait for a reply before sending the next batch.
+ * File data is streamed without any reply from the agent. Only data regions of sparse files
+ * are sent, the agent leaves holes unwritten.
+ */
+class AgentProtocol
+{
+public:
+    enum Message : quint8 {
+        Hello = 1,  //!< sender: version, token, validate target
+        Welcome,    //!< agent: accepted, error message
+        Directory,  //!< sender: batch, relative path, last batch, names, directory flags, modification times
+        Need,       //!< agent: batch, names of requested files, overwrite flags
+        File,       //!< sender: relative path, size, permissions, sparse file
+        Data,       //!< sender: offset, block of file data
+        FileEnd,    //!< sender: file data complete, final size
+        End,        //!< sender: all directories and files sent
+        Summary,    //!< agent: removed files, removed files size, new directories, removed directories
+        Error,      //!< agent: error message
+        Link        //!< sender: relative path, relative path of an existing file to link to
+    };
+
+    static const quint32 VERSION = 3; //!< protocol version
+    static const quint16 DEFAULTPORT = 7887; //!< default TCP port of the agent
+    static const int STREAMVERSION = QDataStream::Qt_5_0; //!< serialization format of message fields
+    static const int DATABLOCK = 256*1024; //!< size of file data block in bytes
+    static const int WINDOW = 64; //!< maximum number of directory batches waiting for reply
+    static const qint64 BUFFERLIMIT = 4*1024*1024; //!< maximum size of unsent data in bytes
+    static const quint32 MESSAGELIMIT = 64*1024*1024; //!< maximum size of a received message in bytes
+
+    static void writeMessage(QIODevice *device, const QByteArray &message);
+    static bool readMessage(QIODevice *device, QByteArray &message);
+
+    static bool isValidName(const QString &name);
+    static bool isValidPath(const QString &path);
+};
+
+#endif // AGENTPROTOCOL_H
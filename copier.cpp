@@ -1,9 +1,32 @@
 #include <QFile>
 #include <QFileInfoList>
 #include <QDir>
+#include <QDirIterator>
 #include <QDateTime>
+#include <QDataStream>
+#include <QStringList>
+#include <QSet>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QUrl>
+#include <limits>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(Q_OS_LINUX)
+#include <errno.h>
+#include <fcntl.h>
+#endif
 
 #include "copier.h"
+#include "agentprotocol.h"
 
 /*!
  * *****************************************************************
@@ -23,6 +46,7 @@
 
 Copier::Copier(QObject *parent) : QThread(parent)
 {
+    connect(&_flusher, &Flusher::signalError, this, &Copier::signalError);
 }
 
 Copier::~Copier()
@@ -41,6 +65,73 @@ void Copier::Setup(QString sourceDirectory, QString targetDirectory, bool valida
 }
 
 
+/*!
+ * \brief Sets the memory budget of directory traversal.
+ * \param memoryBudget Maximum memory in bytes held by open directory levels.
+ *
+ * \remark The directory being processed is always kept open, even if the budget is smaller.
+ */
+void Copier::setMemoryBudget(qint64 memoryBudget)
+{
+    _memoryBudget = memoryBudget;
+}
+
+
+/*!
+ * \brief Returns the memory budget of directory traversal in bytes.
+ */
+qint64 Copier::memoryBudget() const
+{
+    return _memoryBudget;
+}
+
+
+/*!
+ * \brief Sets when copied data are flushed to the target disk.
+ * \param durability Durability mode.
+ *
+ * \remark Applies to local targets on Unix systems only, see isDurabilitySupported.
+ */
+void Copier::setDurability(Durability durability)
+{
+    _durability = durability;
+}
+
+
+/*!
+ * \brief Returns the durability mode.
+ */
+Copier::Durability Copier::durability() const
+{
+    return _durability;
+}
+
+
+/*!
+ * \brief Returns the peak resident memory of the process.
+ * \return peak resident set size in bytes, -1 if not available
+ */
+qint64 Copier::peakMemoryUsage()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return qint64(counters.PeakWorkingSetSize);
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#if defined(Q_OS_MACOS)
+    return qint64(usage.ru_maxrss);
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+}
+
+
 void Copier::run()
 {
     qint64 removedFiles = 0;
@@ -56,13 +147,32 @@ void Copier::run()
     qint64 newDirectories = 0;
     qint64 removedDirectories = 0;
 
+    bool remote = isAgentTarget(_targetDirectory);
+    bool flush;
+    bool result;
+
+    _runDurability = isDurabilitySupported(_targetDirectory) ? _durability : DurabilityNone;
+    flush = _runDurability != DurabilityNone;
+
+    _logicalBytes = 0;
+    _physicalBytes = 0;
+
+    _hardLinks.clear();
+    _hardLinkPaths.clear();
+    _freeHardLinkPaths = 0;
+    _hardLinkMemory = 0;
+    _hardLinksLimited = false;
+    _linkedFiles = 0;
+
+    _pendingMessages.clear();
+    _messageTimer.start();
 
     if (!QFile::exists(_sourceDirectory)) {
         emit signalError("Source directory does not exist");
         return;
     }
 
-    if (!QFile::exists(_targetDirectory)) {
+    if (!remote && !QFile::exists(_targetDirectory)) {
         emit signalError("Target directory does not exist");
         return;
     }
@@ -77,19 +187,60 @@ void Copier::run()
             return;
         }
 
-        emit signalMessage(targetFN);
-        if (!QFile::exists(targetFN)) {
-            emit signalError("Invalid target directory");
-            return;
+        // the agent validates its target directory
+        if (!remote) {
+            emit signalMessage(targetFN);
+            if (!QFile::exists(targetFN)) {
+                emit signalError("Invalid target directory");
+                return;
+            }
         }
+    }
+
+    if (remote && !connectAgent(_targetDirectory)) {
+        disconnectAgent();
+        return;
+    }
+
+    if (_validate) emit signalMessage("Directories validated");
+
+    if (_durability != DurabilityNone && !flush) {
+        emit signalMessage(remote ? "Durability: not supported for siba-agent targets, data are not flushed"
+                                  : "Durability: not supported on this platform, data are not flushed");
+    }
+
+    _durabilityFiles.clear();
+    if (flush) _flusher.begin();
+
+    result = copyDirectories(_sourceDirectory, remote ? QString() : _targetDirectory, _showDetails,
+                             removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                             newFiles, newFilesSize,
+                             directoriesCount, newDirectories, removedDirectories);
+
+    if (remote) {
+        if (result) finishAgent(_showDetails,
+                                removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                                newFiles, newFilesSize,
+                                directoriesCount, newDirectories, removedDirectories);
+        disconnectAgent();
+    }
+
+    flushMessages();
 
-        emit signalMessage("Directories validated");
+    if (flush) {
+        flushDirectoryFiles();
+        if (_runDurability == DurabilityEndOfRun) _flusher.enqueue(Flusher::SyncFileSystem, QStringList(_targetDirectory));
+        emit signalMessage("Flushing data to disk");
+        _flusher.finish();
+        emit signalMessage(QString("Durability: waited %1 ms, flushing %2 ms")
+                           .arg(_flusher.waitMilliseconds()).arg(_flusher.flushMilliseconds()));
     }
 
-    copyDirectories(_sourceDirectory, _targetDirectory, _showDetails,
-                    removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
-                    newFiles, newFilesSize,
-                    directoriesCount, newDirectories, removedDirectories);
+    emit signalMessage(QString("Hard links: %1").arg(_linkedFiles));
+    emit signalMessage(QString("Copied data: %1 MB, written to disk: %2 MB")
+                       .arg(_logicalBytes/(1024*1024)).arg(_physicalBytes/(1024*1024)));
+    emit signalMessage(QString("Peak memory: %1 MB, directory traversal: %2 KB")
+                       .arg(peakMemoryUsage()/(1024*1024)).arg(_peakTraversalMemory/1024));
 
     emit signalBackupFinished(removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
                               newFiles, newFilesSize,
@@ -106,9 +257,14 @@ bool Copier::showStatus(QString message, bool printMessage,
 {
     qint64 secs = QDateTime::currentSecsSinceEpoch();
 
+    // with details, every message is logged, statistics are still updated periodically
+    if (printMessage && _showDetails) postMessage(message);
+
     if (printMessage && (MESSAGELIMITSECONDS <= (secs - lastMessageSeconds))) {
         lastMessageSeconds = secs;
-        emit signalStatus(message, removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+        flushMessages();
+        emit signalStatus(_showDetails ? QString() : message,
+                          removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
                           newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories);
         if (isInterruptionRequested()) return false;
     }
@@ -116,29 +272,212 @@ bool Copier::showStatus(QString message, bool printMessage,
 }
 
 
+/*!
+ * \brief Queues a detail message, messages are sent in batches.
+ * \param message Detail message.
+ *
+ * A batch is sent after MESSAGEBATCH messages or MESSAGEBATCHMILLISECONDS,
+ * so the user interface receives a few signals per second regardless of the number of messages.
+ */
+void Copier::postMessage(QString message)
+{
+    _pendingMessages << message;
+    if (MESSAGEBATCH <= _pendingMessages.size() || MESSAGEBATCHMILLISECONDS <= _messageTimer.elapsed())
+        flushMessages();
+}
+
+
+/*!
+ * \brief Sends queued detail messages.
+ */
+void Copier::flushMessages()
+{
+    _messageTimer.restart();
+    if (_pendingMessages.isEmpty()) return;
+
+    emit signalMessages(_pendingMessages);
+    _pendingMessages.clear();
+}
+
+
 
+/*!
+ * \brief Synchronizes the directory tree without recursion.
+ * \param sourceDirectory Full path to source directory.
+ * \param targetDirectory Full path to target directory.
+ * \param showDetails Print detailed message.
+ * \return true if archiving was successful
+ *
+ * Directories are visited depth-first from an explicit stack of frames,
+ * the state of a directory is released as soon as all its subdirectories are done.
+ * For a remote target, targetDirectory is relative to the target directory of the agent.
+ */
 bool Copier::copyDirectories(QString sourceDirectory, QString targetDirectory, bool showDetails,
                              qint64 &removedFiles, qint64 &removedFilesSize,
                              qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
                              qint64 &newFiles, qint64 &newFilesSize,
                              qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories)
 {
-    if (isInterruptionRequested()) return false;
+    QStack<DirectoryFrame> frames;
+    QString sourceFN, targetFN;
+    bool result = true;
 
-    directoriesCount++;
-    showStatus(sourceDirectory, true,
-               removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
-               newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories);
+    _traversalMemory = _hardLinkMemory;
+    _peakTraversalMemory = _traversalMemory;
+
+    frames.push({sourceDirectory, targetDirectory, nullptr, QString(), false});
+    _traversalMemory += frameMemory(frames.top());
+    _peakTraversalMemory = qMax(_peakTraversalMemory, _traversalMemory);
+
+    while (!frames.isEmpty()) {
+        if (isInterruptionRequested()) {
+            result = false;
+            break;
+        }
+
+        if (!frames.top().synchronized) {
+            DirectoryFrame &frame = frames.top();
+            frame.synchronized = true;
+
+            directoriesCount++;
+            showStatus(frame.sourceDirectory, true,
+                       removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                       newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories);
+
+            if (_agent != nullptr) {
+                result = sendDirectory(frame.sourceDirectory, frame.targetDirectory, showDetails,
+                                       removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                                       newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories);
+            }
+            else {
+                result = synchronizeFiles(frame.sourceDirectory, frame.targetDirectory, showDetails,
+                                          removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                                          newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)
+                        && synchronizeDirectories(frame.sourceDirectory, frame.targetDirectory, showDetails,
+                                                  removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                                                  newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories);
+                if (_runDurability == DurabilityPerDirectory) {
+                    // files of the directory are final, their directory entries are flushed after them
+                    flushDirectoryFiles();
+                    _flusher.enqueue(Flusher::SyncDirectory, QStringList(frame.targetDirectory));
+                }
+            }
+            if (!result) break;
+        }
+
+        if (nextDirectory(frames, sourceFN, targetFN)) {
+            // the agent creates directories of a remote target
+            if (_agent == nullptr && !QFile::exists(targetFN)) {
+                QDir().mkdir(targetFN);
+                newDirectories++;
+            }
+            frames.push({sourceFN, targetFN, nullptr, QString(), false});
+            _traversalMemory += frameMemory(frames.top());
+            _peakTraversalMemory = qMax(_peakTraversalMemory, _traversalMemory);
+        }
+        else {
+            // entries of the directory are final when all its subdirectories are created,
+            // this sync also covers subdirectories created after its files were flushed
+            if (DurabilityPerDirectory <= _runDurability)
+                _flusher.enqueue(Flusher::SyncDirectory, QStringList(frames.top().targetDirectory));
+            closeFrame(frames.top());
+            _traversalMemory -= frameMemory(frames.top());
+            frames.pop();
+        }
+    }
+
+    while (!frames.isEmpty()) {
+        closeFrame(frames.top());
+        _traversalMemory -= frameMemory(frames.top());
+        frames.pop();
+    }
+
+    return result;
+}
+
+
+/*!
+ * \brief Returns the next subdirectory of the top frame.
+ * \param frames Stack of directory frames.
+ * \param sourceDirectory Receives full path to source subdirectory.
+ * \param targetDirectory Receives full path to target subdirectory.
+ * \return false if all subdirectories of the top frame are visited
+ */
+bool Copier::nextDirectory(QStack<DirectoryFrame> &frames, QString &sourceDirectory, QString &targetDirectory)
+{
+    DirectoryFrame &frame = frames.top();
+
+    if (frame.iterator == nullptr) openFrame(frames, frame);
+    if (!frame.iterator->hasNext()) return false;
+
+    frame.iterator->next();
+    _traversalMemory += (frame.iterator->fileName().size() - frame.lastName.size()) * qint64(sizeof(QChar));
+    frame.lastName = frame.iterator->fileName();
+    sourceDirectory = frame.iterator->filePath();
+    targetDirectory = frame.targetDirectory + "/" + frame.lastName;
+    return true;
+}
 
-    if (!synchronizeFiles(sourceDirectory, targetDirectory, showDetails,
-                          removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
-                          newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories))
-        return false;
 
-    return synchronizeDirectories(sourceDirectory, targetDirectory, showDetails,
-                                  removedFiles, removedFilesSize,
-                                  overwrittenFiles, overwrittenFilesSize, newFiles, newFilesSize,
-                                  directoriesCount, newDirectories, removedDirectories);
+/*!
+ * \brief Opens the subdirectory iterator of a frame within the memory budget.
+ * \param frames Stack of directory frames.
+ * \param frame Frame to open.
+ *
+ * Iterators of the shallowest frames are released first, they are resumed last.
+ * A reopened iterator skips entries up to the last visited subdirectory, found by name,
+ * because subdirectories may be created or removed while the iterator is released.
+ * If the last visited subdirectory itself was removed, the position cannot be found
+ * and all subdirectories of the frame are visited again, none is skipped.
+ */
+void Copier::openFrame(QStack<DirectoryFrame> &frames, DirectoryFrame &frame)
+{
+    for (int i = 0; i < frames.size() && _memoryBudget < _traversalMemory + ITERATORMEMORY; i++) {
+        if (&frames[i] != &frame) closeFrame(frames[i]);
+    }
+
+    frame.iterator = new QDirIterator(frame.sourceDirectory, QDir::Filter::Hidden | QDir::Filter::AllDirs | QDir::Filter::NoDotAndDotDot);
+    if (!frame.lastName.isEmpty()) {
+        bool found = false;
+        while (!found && frame.iterator->hasNext()) {
+            frame.iterator->next();
+            found = frame.iterator->fileName() == frame.lastName;
+        }
+        if (!found) {
+            emit signalMessage("Directory changed during backup, subdirectories are visited again: " + frame.sourceDirectory);
+            delete frame.iterator;
+            frame.iterator = new QDirIterator(frame.sourceDirectory, QDir::Filter::Hidden | QDir::Filter::AllDirs | QDir::Filter::NoDotAndDotDot);
+        }
+    }
+
+    _traversalMemory += ITERATORMEMORY;
+    _peakTraversalMemory = qMax(_peakTraversalMemory, _traversalMemory);
+}
+
+
+/*!
+ * \brief Releases the subdirectory iterator of a frame.
+ * \param frame Frame to close.
+ */
+void Copier::closeFrame(DirectoryFrame &frame)
+{
+    if (frame.iterator == nullptr) return;
+    delete frame.iterator;
+    frame.iterator = nullptr;
+    _traversalMemory -= ITERATORMEMORY;
+}
+
+
+/*!
+ * \brief Estimates the memory held by a frame.
+ * \param frame Directory frame.
+ * \return memory in bytes
+ */
+qint64 Copier::frameMemory(const DirectoryFrame &frame) const
+{
+    return qint64(sizeof(DirectoryFrame))
+            + (frame.sourceDirectory.size() + frame.targetDirectory.size() + frame.lastName.size()) * qint64(sizeof(QChar))
+            + (frame.iterator == nullptr ? 0 : ITERATORMEMORY);
 }
 
 
@@ -151,6 +490,8 @@ bool Copier::copyDirectories(QString sourceDirectory, QString targetDirectory, b
  * \param String targetDirectory: full path to target directory
  * \param showDetails: print detailed message
  * \return true if archiving was successful
+ *
+ * Entries are streamed from directory iterators, lists of files are not held in memory.
  */
 bool Copier::synchronizeFiles(QString sourceDirectory, QString targetDirectory, bool showDetails,
                               qint64 &removedFiles, qint64 &removedFilesSize,
@@ -159,20 +500,15 @@ bool Copier::synchronizeFiles(QString sourceDirectory, QString targetDirectory,
                               qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories)
 
 {
-    QDir *sourceDir, *targetDir;
-    QFileInfoList sourceFileList;
-    QFileInfoList targetFileList;
+    QDirIterator targetIterator(targetDirectory, QDir::Filter::Hidden | QDir::Filter::Files);
     QString sourceFN, targetFN;
-    QFileInfo *tfInfo;
-
-    sourceDir = new QDir(sourceDirectory);
-    sourceFileList = sourceDir->entryInfoList(QDir::Filter::Hidden | QDir::Filter::Files);
-
-    targetDir = new QDir(targetDirectory);
-    targetFileList = targetDir->entryInfoList(QDir::Filter::Hidden | QDir::Filter::Files);
+    qint64 entries = 0;
 
     // remove files
-    foreach (QFileInfo targetFileInfo, targetFileList) {
+    while (targetIterator.hasNext()) {
+        targetIterator.next();
+        QFileInfo targetFileInfo = targetIterator.fileInfo();
+        if (++entries % ENTRYCHUNK == 0 && isInterruptionRequested()) return false;
         if (targetFileInfo.isFile()) {
             targetFN = targetFileInfo.fileName();
             if (targetFN != SOURCEDIRID && targetFN != TARGETDIRID) {
@@ -193,28 +529,44 @@ bool Copier::synchronizeFiles(QString sourceDirectory, QString targetDirectory,
         }
     }
 
+    QDirIterator sourceIterator(sourceDirectory, QDir::Filter::Hidden | QDir::Filter::Files);
+
     // copy or overwrite files
-    foreach (QFileInfo sourceFileInfo, sourceFileList) {
+    while (sourceIterator.hasNext()) {
+        sourceIterator.next();
+        QFileInfo sourceFileInfo = sourceIterator.fileInfo();
+        if (++entries % ENTRYCHUNK == 0 && isInterruptionRequested()) return false;
         if (sourceFileInfo.isFile())
         {
             sourceFN = sourceFileInfo.fileName();
             if (sourceFN != SOURCEDIRID && sourceFN != TARGETDIRID) {
                 targetFN = targetDirectory + "/" + sourceFN;
-                if (QFile::exists(targetFN)) {
-                    tfInfo = new QFileInfo(targetFN);
-                    if (tfInfo->lastModified() < sourceFileInfo.lastModified()) {
+                QFileInfo tfInfo(targetFN);
+                if (tfInfo.exists()) {
+                    if (tfInfo.lastModified() < sourceFileInfo.lastModified()) {
                         QFile(targetFN).setPermissions(QFile::ReadOther | QFile::WriteOther);
                         QFile::remove(targetFN);
-                        QFile::copy(sourceFileInfo.filePath(), targetFN);
+                        if (!copyOrLinkFile(sourceFileInfo.filePath(), targetFN)) {
+                            emit signalError(QString("Cannot copy file " + sourceFileInfo.filePath()));
+                        }
                         overwrittenFilesSize += sourceFileInfo.size();
                         overwrittenFiles++;
                         if (!showStatus(QString("overwrite " + targetFN), showDetails,
                                         removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
                                         newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)) return false;
                     }
+                    else {
+                        // later links of the source file are linked to the unchanged target
+                        HardLinkKey key;
+                        quint32 links;
+                        hardLinkTarget(sourceFileInfo.filePath(), key, links);
+                        rememberHardLink(key, links, targetFN);
+                    }
                 }
                 else {
-                    QFile::copy(sourceFileInfo.filePath(), targetFN);
+                    if (!copyOrLinkFile(sourceFileInfo.filePath(), targetFN)) {
+                        emit signalError(QString("Cannot copy file " + sourceFileInfo.filePath()));
+                    }
                     newFilesSize += sourceFileInfo.size();
                     newFiles++;
                     if (!showStatus(QString("copy " + sourceFileInfo.fileName()), showDetails,
@@ -230,13 +582,309 @@ bool Copier::synchronizeFiles(QString sourceDirectory, QString targetDirectory,
 
 
 
+/*!
+ * \brief Copies a file, holes of sparse files are preserved.
+ * \param sourceFN Full path to source file.
+ * \param targetFN Full path to target file, the file must not exist.
+ * \return true if the file was copied
+ *
+ * On Linux, data regions of sparse files are located with SEEK_DATA and SEEK_HOLE
+ * and only these regions are written, the rest of the target remains a hole.
+ * Other files are preallocated to their final size to reduce fragmentation.
+ * On other systems, QFile::copy is used.
+ */
+bool Copier::copyFile(QString sourceFN, QString targetFN)
+{
+#if defined(Q_OS_LINUX)
+    QByteArray sourcePath = QFile::encodeName(sourceFN);
+    QByteArray targetPath = QFile::encodeName(targetFN);
+    struct stat sourceStat;
+    int sourceFd, targetFd;
+    off_t offset, position;
+    qint64 dataStart, dataEnd;
+    ssize_t count, written;
+    bool sparse;
+    bool result = true;
+
+    sourceFd = ::open(sourcePath.constData(), O_RDONLY | O_CLOEXEC);
+    if (sourceFd < 0) return false;
+    if (fstat(sourceFd, &sourceStat) != 0) {
+        ::close(sourceFd);
+        return false;
+    }
+
+    targetFd = ::open(targetPath.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (targetFd < 0) {
+        ::close(sourceFd);
+        return false;
+    }
+
+    if (_copyBuffer.size() != COPYBUFFERSIZE) _copyBuffer.resize(int(COPYBUFFERSIZE));
+
+    sparse = qint64(sourceStat.st_blocks) * 512 < qint64(sourceStat.st_size);
+    if (!sparse && 0 < sourceStat.st_size) {
+        // failure is not an error, e.g. the file system does not support preallocation
+        fallocate(targetFd, 0, 0, sourceStat.st_size);
+    }
+
+    offset = 0;
+    while (result && offset < sourceStat.st_size
+           && nextDataRegion(sourceFd, offset, sourceStat.st_size, sparse, dataStart, dataEnd)) {
+        position = off_t(dataStart);
+        while (result && position < dataEnd) {
+            count = pread(sourceFd, _copyBuffer.data(), size_t(qMin(COPYBUFFERSIZE, dataEnd - position)), position);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) result = false;
+            if (count <= 0) break;
+
+            for (ssize_t done = 0; result && done < count; ) {
+                written = pwrite(targetFd, _copyBuffer.constData() + done, size_t(count - done), position + done);
+                if (written < 0 && errno == EINTR) continue;
+                if (written <= 0) result = false;
+                else done += written;
+            }
+
+            position += count;
+            _physicalBytes += count;
+        }
+        offset = off_t(dataEnd);
+    }
+
+    // trailing hole of a sparse file
+    if (result && ftruncate(targetFd, sourceStat.st_size) != 0) result = false;
+    if (result && fchmod(targetFd, sourceStat.st_mode & 0777) != 0) result = false;
+
+    ::close(sourceFd);
+    if (::close(targetFd) != 0) result = false;
+
+    if (!result) {
+        QFile::remove(targetFN);
+        return false;
+    }
+
+    _logicalBytes += sourceStat.st_size;
+    scheduleFlush(targetFN);
+    return true;
+#else
+    if (!QFile::copy(sourceFN, targetFN)) return false;
+
+    qint64 size = QFileInfo(targetFN).size();
+    _logicalBytes += size;
+    _physicalBytes += size;
+    scheduleFlush(targetFN);
+    return true;
+#endif
+}
+
+
+/*!
+ * \brief Finds the next data region of a file, holes of sparse files are skipped.
+ * \param fd Open file.
+ * \param offset Position to search from.
+ * \param size Size of the file in bytes.
+ * \param sparse The file is sparse, cleared if the file system cannot locate holes.
+ * \param dataStart Receives the start of the data region.
+ * \param dataEnd Receives the end of the data region.
+ * \return false if the rest of the file is a hole
+ *
+ * On Linux, data regions of sparse files are located with SEEK_DATA and SEEK_HOLE.
+ * Otherwise, the rest of the file is one data region.
+ */
+bool Copier::nextDataRegion(int fd, qint64 offset, qint64 size, bool &sparse, qint64 &dataStart, qint64 &dataEnd)
+{
+    dataStart = offset;
+    dataEnd = size;
+
+#if defined(Q_OS_LINUX)
+    if (sparse) {
+        off_t start = lseek(fd, off_t(offset), SEEK_DATA);
+        if (start < 0) {
+            if (errno == ENXIO) return false;
+            sparse = false;
+        }
+        else {
+            off_t end = lseek(fd, start, SEEK_HOLE);
+            dataStart = start;
+            if (0 <= end) dataEnd = qMin(qint64(end), size);
+        }
+    }
+#else
+    Q_UNUSED(fd)
+    sparse = false;
+#endif
+
+    return true;
+}
+
+
+/*!
+ * \brief Copies a file, or links it to the target of another link of the same source file.
+ * \param sourceFN Full path to source file.
+ * \param targetFN Full path to target file, the file must not exist.
+ * \return true if the file was copied or linked
+ */
+bool Copier::copyOrLinkFile(QString sourceFN, QString targetFN)
+{
+    HardLinkKey key;
+    quint32 links;
+    QString linkTarget = hardLinkTarget(sourceFN, key, links);
+
+#if defined(Q_OS_UNIX)
+    if (!linkTarget.isEmpty()
+            && ::link(QFile::encodeName(linkTarget).constData(), QFile::encodeName(targetFN).constData()) == 0) {
+        rememberHardLink(key, links, targetFN);
+        _linkedFiles++;
+        return true;
+    }
+#else
+    Q_UNUSED(linkTarget)
+#endif
+
+    // the file is copied also if linking failed, e.g. the link count limit was reached
+    if (!copyFile(sourceFN, targetFN)) return false;
+    rememberHardLink(key, links, targetFN);
+    return true;
+}
+
+
+/*!
+ * \brief Looks up a source file with several hard links.
+ * \param sourceFN Full path to source file.
+ * \param key Receives the device and inode of the source file.
+ * \param links Receives the number of links of the source file, 0 if the file is not multiply-linked.
+ * \return target of an already visited link of the source file, empty string if there is none
+ */
+QString Copier::hardLinkTarget(QString sourceFN, HardLinkKey &key, quint32 &links)
+{
+    links = 0;
+
+#if defined(Q_OS_UNIX)
+    struct stat sourceStat;
+
+    if (::stat(QFile::encodeName(sourceFN).constData(), &sourceStat) != 0 || sourceStat.st_nlink < 2)
+        return QString();
+
+    key = qMakePair(quint64(sourceStat.st_dev), quint64(sourceStat.st_ino));
+    links = quint32(sourceStat.st_nlink);
+
+    QHash<HardLinkKey, HardLink>::const_iterator link = _hardLinks.constFind(key);
+    if (link != _hardLinks.constEnd()) return QFile::decodeName(_hardLinkPaths.constData() + link->path);
+#else
+    Q_UNUSED(sourceFN)
+    Q_UNUSED(key)
+#endif
+
+    return QString();
+}
+
+
+/*!
+ * \brief Records a visited link of a multiply-linked source file.
+ * \param key Device and inode of the source file.
+ * \param links Number of links of the source file.
+ * \param targetFN Full path to target file.
+ *
+ * The first visited link is remembered. The entry is removed after the last link
+ * is visited, so the table holds only files with links not visited yet.
+ * Entries of files linked also from outside the source tree are never removed, so the table
+ * may use at most half of the memory budget, further files are copied without linking.
+ */
+void Copier::rememberHardLink(const HardLinkKey &key, quint32 links, QString targetFN)
+{
+    if (links < 2) return;
+
+    QHash<HardLinkKey, HardLink>::iterator link = _hardLinks.find(key);
+    if (link == _hardLinks.end()) {
+        QByteArray path = QFile::encodeName(targetFN);
+        if (_memoryBudget/2 < _hardLinkMemory + HARDLINKMEMORY + path.size() + 1
+                || std::numeric_limits<int>::max() - _hardLinkPaths.size() <= path.size()) {
+            if (!_hardLinksLimited) {
+                _hardLinksLimited = true;
+                emit signalMessage("Memory budget of hard links exceeded, further multiply-linked files are copied");
+            }
+            return;
+        }
+        _hardLinks.insert(key, {_hardLinkPaths.size(), links - 1});
+        _hardLinkPaths.append(path.constData(), path.size() + 1);
+    }
+    else if (--link->links == 0) {
+        _freeHardLinkPaths += int(qstrlen(_hardLinkPaths.constData() + link->path)) + 1;
+        _hardLinks.erase(link);
+        if (_hardLinkPaths.size() < 2*_freeHardLinkPaths) compactHardLinkPaths();
+    }
+    updateHardLinkMemory();
+}
+
+
+/*!
+ * \brief Removes paths of removed entries from the path pool of hard links.
+ */
+void Copier::compactHardLinkPaths()
+{
+    QByteArray paths;
+
+    paths.reserve(_hardLinkPaths.size() - _freeHardLinkPaths);
+    for (QHash<HardLinkKey, HardLink>::iterator link = _hardLinks.begin(); link != _hardLinks.end(); ++link) {
+        const char *path = _hardLinkPaths.constData() + link->path;
+        link->path = paths.size();
+        paths.append(path, int(qstrlen(path)) + 1);
+    }
+    _hardLinkPaths = paths;
+    _freeHardLinkPaths = 0;
+}
+
+
+/*!
+ * \brief Updates the estimated memory of the hard link table in the traversal memory.
+ */
+void Copier::updateHardLinkMemory()
+{
+    qint64 memory = _hardLinks.size()*HARDLINKMEMORY + _hardLinkPaths.size();
+
+    _traversalMemory += memory - _hardLinkMemory;
+    _peakTraversalMemory = qMax(_peakTraversalMemory, _traversalMemory);
+    _hardLinkMemory = memory;
+}
+
+
+/*!
+ * \brief Queues a copied file for flushing according to the durability mode.
+ * \param targetFN Full path to target file.
+ */
+void Copier::scheduleFlush(QString targetFN)
+{
+    if (_runDurability == DurabilityPerFile) {
+        _flusher.enqueue(Flusher::SyncFiles, QStringList(targetFN));
+        _flusher.enqueue(Flusher::SyncDirectory, QStringList(QFileInfo(targetFN).path()));
+    }
+    else if (_runDurability == DurabilityPerDirectory) {
+        _durabilityFiles << targetFN;
+        if (Flusher::BATCHSIZE <= _durabilityFiles.size()) flushDirectoryFiles();
+    }
+}
+
+
+/*!
+ * \brief Queues copied files of the current directory for flushing as one batch.
+ */
+void Copier::flushDirectoryFiles()
+{
+    if (_durabilityFiles.isEmpty()) return;
+    _flusher.enqueue(Flusher::SyncFiles, _durabilityFiles);
+    _durabilityFiles.clear();
+}
+
+
+
 /*!
  * \fn bool MainWindow::synchronizeDirectories(QString sourceDirectory, QString targetDirectory, bool showDetails)
- * \brief recursively copy and remove subdirectories
+ * \brief remove target subdirectories missing in source directory
  * \param sourceDirectory: full path to source directory
  * \param targetDirectory: full path to target directory
  * \param showDetails: print detailed message
  * \return true if archiving was successful
+ *
+ * Subdirectories are copied by copyDirectories.
  */
 bool Copier::synchronizeDirectories(QString sourceDirectory, QString targetDirectory, bool showDetails,
                                     qint64 &removedFiles, qint64 &removedFilesSize,
@@ -244,62 +892,518 @@ bool Copier::synchronizeDirectories(QString sourceDirectory, QString targetDirec
                                     qint64 &newFiles, qint64 &newFilesSize,
                                     qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories)
 {
-    QDir *sourceDir, *targetDir, *subDir;
-    QFileInfoList sourceFileList;
-    QFileInfoList targetFileList;
-    QString sourceFN, targetFN;
-
-    sourceDir = new QDir(sourceDirectory);
-    sourceFileList = sourceDir->entryInfoList(QDir::Filter::Hidden | QDir::Filter::AllDirs);
+    Q_UNUSED(showDetails)
 
-    targetDir = new QDir(targetDirectory);
-    targetFileList = targetDir->entryInfoList(QDir::Filter::Hidden | QDir::Filter::AllDirs);
+    QDirIterator targetIterator(targetDirectory, QDir::Filter::Hidden | QDir::Filter::AllDirs | QDir::Filter::NoDotAndDotDot);
+    QString sourceFN, targetFN;
+    qint64 entries = 0;
 
     // remove directories
-    foreach (QFileInfo targetFileInfo, targetFileList) {
+    while (targetIterator.hasNext()) {
+        targetIterator.next();
+        QFileInfo targetFileInfo = targetIterator.fileInfo();
+        if (++entries % ENTRYCHUNK == 0 && isInterruptionRequested()) return false;
         if (!targetFileInfo.isFile()) {
             targetFN = targetFileInfo.fileName();
-            if (targetFN != "." && targetFN != "..") {
-                sourceFN = sourceDirectory + "/" + targetFN;
-                if (!QFile::exists(sourceFN)) {
-                    QFile(targetFileInfo.filePath()).setPermissions(QFile::ReadOther | QFile::WriteOther);
-                    subDir = new QDir(targetFileInfo.filePath());
-                    subDir->removeRecursively();
-                    removedDirectories++;
-                    if (!showStatus(QString("remove directory " + targetFileInfo.filePath()), true,
-                                    removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
-                                    newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)) return false;
-                }
+            sourceFN = sourceDirectory + "/" + targetFN;
+            if (!QFile::exists(sourceFN)) {
+                QFile(targetFileInfo.filePath()).setPermissions(QFile::ReadOther | QFile::WriteOther);
+                QDir(targetFileInfo.filePath()).removeRecursively();
+                removedDirectories++;
+                if (!showStatus(QString("remove directory " + targetFileInfo.filePath()), true,
+                                removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                                newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)) return false;
             }
         }
     }
 
-    // copy directories
-    foreach (QFileInfo sourceFileInfo, sourceFileList) {
-        if (!sourceFileInfo.isFile())
-        {
+    return true;
+}
+
+
+
+
+/*!
+ * \brief Checks if the target is a siba-agent address.
+ * \param targetDirectory Target directory or agent address,
+ *        siba://[token@]host[:port] for TCP, siba+unix:///path for a local socket.
+ * \return true if the target is an agent address
+ */
+bool Copier::isAgentTarget(QString targetDirectory)
+{
+    return targetDirectory.startsWith("siba://") || targetDirectory.startsWith("siba+unix://");
+}
+
+
+/*!
+ * \brief Checks if copied data can be flushed to the target disk.
+ * \param targetDirectory Target directory or agent address.
+ * \return false for siba-agent targets and on systems other than Unix
+ */
+bool Copier::isDurabilitySupported(QString targetDirectory)
+{
+#if defined(Q_OS_UNIX)
+    return !isAgentTarget(targetDirectory);
+#else
+    Q_UNUSED(targetDirectory)
+    return false;
+#endif
+}
+
+
+/*!
+ * \brief Connects to siba-agent and validates the remote target directory.
+ * \param target Agent address.
+ * \return true if the agent accepted the connection
+ *
+ * The access token is the user name of the address, the SIBA_AGENT_TOKEN environment variable by default.
+ */
+bool Copier::connectAgent(QString target)
+{
+    QUrl url(target);
+    QString token = url.userName();
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    bool connected;
+
+    if (token.isEmpty()) token = QString::fromLocal8Bit(qgetenv("SIBA_AGENT_TOKEN"));
+
+    if (url.scheme() == "siba+unix") {
+        QLocalSocket *socket = new QLocalSocket();
+        socket->connectToServer(url.path());
+        connected = socket->waitForConnected(AGENTTIMEOUT);
+        _agent = socket;
+    }
+    else {
+        QTcpSocket *socket = new QTcpSocket();
+        socket->connectToHost(url.host(), quint16(url.port(AgentProtocol::DEFAULTPORT)));
+        connected = socket->waitForConnected(AGENTTIMEOUT);
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        _agent = socket;
+    }
+
+    if (!connected) {
+        emit signalError("Cannot connect to agent: " + _agent->errorString());
+        return false;
+    }
+
+    _agentBatch = 0;
+    _agentBatches.clear();
+    _agentFiles.clear();
+
+    out.setVersion(AgentProtocol::STREAMVERSION);
+    out << quint8(AgentProtocol::Hello) << quint32(AgentProtocol::VERSION) << token << _validate;
+    if (!sendAgentMessage(message)) return false;
+
+    while (!AgentProtocol::readMessage(_agent, message)) {
+        if (!waitAgent()) return false;
+    }
+
+    QDataStream in(message);
+    quint8 type = 0;
+    bool accepted = false;
+    QString error;
+
+    in.setVersion(AgentProtocol::STREAMVERSION);
+    in >> type >> accepted >> error;
+    if (type != AgentProtocol::Welcome || !accepted) {
+        emit signalError(error.isEmpty() ? QString("Invalid agent") : error);
+        return false;
+    }
+
+    emit signalMessage("Connected to agent " + url.host() + url.path());
+    return true;
+}
+
+
+/*!
+ * \brief Closes the connection to siba-agent.
+ */
+void Copier::disconnectAgent()
+{
+    if (_agent == nullptr) return;
+
+    _agent->close();
+    delete _agent;
+    _agent = nullptr;
+
+    _agentBatches.clear();
+    _agentFiles.clear();
+}
+
+
+/*!
+ * \brief Returns true if the connection to siba-agent is open.
+ */
+bool Copier::isAgentConnected() const
+{
+    QAbstractSocket *tcpSocket = qobject_cast<QAbstractSocket*>(_agent);
+    if (tcpSocket != nullptr) return tcpSocket->state() == QAbstractSocket::ConnectedState;
+
+    QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(_agent);
+    if (localSocket != nullptr) return localSocket->state() == QLocalSocket::ConnectedState;
+
+    return false;
+}
+
+
+/*!
+ * \brief Waits for data from siba-agent, unsent data are written meanwhile.
+ * \return false if the connection is lost or interruption is requested
+ */
+bool Copier::waitAgent()
+{
+    while (!_agent->waitForReadyRead(AGENTPOLL)) {
+        if (isInterruptionRequested()) return false;
+        if (!isAgentConnected()) {
+            emit signalError("Connection to agent lost");
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Sends a message to siba-agent.
+ * \param message Message payload.
+ * \return false if the connection is lost or interruption is requested
+ *
+ * Blocks only while more than BUFFERLIMIT bytes wait to be sent.
+ */
+bool Copier::sendAgentMessage(const QByteArray &message)
+{
+    AgentProtocol::writeMessage(_agent, message);
+
+    while (AgentProtocol::BUFFERLIMIT < _agent->bytesToWrite()) {
+        if (!_agent->waitForBytesWritten(AGENTPOLL)) {
+            if (isInterruptionRequested()) return false;
+            if (!isAgentConnected()) {
+                emit signalError("Connection to agent lost");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+/*!
+ * \brief Sends the listing of a source directory to siba-agent.
+ * \param sourceDirectory Full path to source directory.
+ * \param targetDirectory Path to target directory relative to the target directory of the agent.
+ * \param showDetails Print detailed message.
+ * \return true if archiving was successful
+ *
+ * The listing is sent in batches of ENTRYCHUNK entries, the agent replies to every batch
+ * with the files it needs. At most AgentProtocol::WINDOW batches wait for reply,
+ * requested files are streamed as soon as the reply arrives.
+ * Multiply-linked files are kept with the batch, the files not requested are recorded
+ * as hard link targets when the reply arrives.
+ */
+bool Copier::sendDirectory(QString sourceDirectory, QString targetDirectory, bool showDetails,
+                           qint64 &removedFiles, qint64 &removedFilesSize,
+                           qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
+                           qint64 &newFiles, qint64 &newFilesSize,
+                           qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories)
+{
+    QDirIterator sourceIterator(sourceDirectory, QDir::Filter::Hidden | QDir::Filter::Files | QDir::Filter::AllDirs | QDir::Filter::NoDotAndDotDot);
+    QStringList names;
+    QList<bool> directories;
+    QList<qint64> modified;
+    QList<AgentLink> links;
+    QString sourceFN;
+    HardLinkKey key;
+    quint32 linkCount;
+    bool last;
+
+    do {
+        names.clear();
+        directories.clear();
+        modified.clear();
+        links.clear();
+
+        while (names.size() < ENTRYCHUNK && sourceIterator.hasNext()) {
+            sourceIterator.next();
+            QFileInfo sourceFileInfo = sourceIterator.fileInfo();
             sourceFN = sourceFileInfo.fileName();
-            if (sourceFN != "." && sourceFN != "..") {
-                targetFN = targetDirectory + "/" + sourceFN;
-                if (QFile::exists(targetFN)) {
-                    if (!copyDirectories(sourceFileInfo.filePath(), targetFN, showDetails,
-                                         removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
-                                         newFiles, newFilesSize,
-                                         directoriesCount, newDirectories, removedDirectories))
-                        return false;
+            if (sourceFileInfo.isFile() && (sourceFN == SOURCEDIRID || sourceFN == TARGETDIRID)) continue;
+            names << sourceFN;
+            directories << sourceFileInfo.isDir();
+            modified << sourceFileInfo.lastModified().toMSecsSinceEpoch();
+            if (sourceFileInfo.isFile()) {
+                hardLinkTarget(sourceFileInfo.filePath(), key, linkCount);
+                if (1 < linkCount) links << AgentLink{sourceFN, key, linkCount};
+            }
+        }
+        last = !sourceIterator.hasNext();
+
+        QByteArray message;
+        QDataStream out(&message, QIODevice::WriteOnly);
+        out.setVersion(AgentProtocol::STREAMVERSION);
+        _agentBatch++;
+        out << quint8(AgentProtocol::Directory) << _agentBatch << targetDirectory << last << names << directories << modified;
+        if (!sendAgentMessage(message)) return false;
+        _agentBatches.insert(_agentBatch, {sourceDirectory, targetDirectory, links});
+
+        if (!processAgentMessages(false, removedFiles, removedFilesSize, newDirectories, removedDirectories))
+            return false;
+        while (AgentProtocol::WINDOW <= _agentBatches.size()) {
+            if (!processAgentMessages(true, removedFiles, removedFilesSize, newDirectories, removedDirectories))
+                return false;
+        }
+
+        if (!sendAgentFiles(showDetails,
+                            removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                            newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories))
+            return false;
+    } while (!last);
+
+    return true;
+}
+
+
+/*!
+ * \brief Streams files requested by siba-agent.
+ * \param showDetails Print detailed message.
+ * \return true if archiving was successful
+ */
+bool Copier::sendAgentFiles(bool showDetails,
+                            qint64 &removedFiles, qint64 &removedFilesSize,
+                            qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
+                            qint64 &newFiles, qint64 &newFilesSize,
+                            qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories)
+{
+    while (!_agentFiles.isEmpty()) {
+        AgentFile file = _agentFiles.dequeue();
+        QFile source(file.sourceFN);
+        qint64 size;
+        bool complete = true;
+        HardLinkKey key;
+        quint32 links;
+        QString linkTarget = hardLinkTarget(file.sourceFN, key, links);
+
+        // the agent links the file to the target of an already sent link
+        if (!linkTarget.isEmpty()) {
+            QByteArray linkMessage;
+            QDataStream linkOut(&linkMessage, QIODevice::WriteOnly);
+            linkOut.setVersion(AgentProtocol::STREAMVERSION);
+            linkOut << quint8(AgentProtocol::Link) << file.targetFN << linkTarget;
+            if (!sendAgentMessage(linkMessage)) return false;
+
+            rememberHardLink(key, links, file.targetFN);
+            _linkedFiles++;
+            size = QFileInfo(file.sourceFN).size();
+            if (file.overwrite) {
+                overwrittenFilesSize += size;
+                overwrittenFiles++;
+            }
+            else {
+                newFilesSize += size;
+                newFiles++;
+            }
+            if (!showStatus(QString("link " + file.targetFN), showDetails,
+                            removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                            newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)) return false;
+            continue;
+        }
+
+        // unbuffered, every data region is read after seeking to its start
+        if (!source.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            emit signalError(QString("Cannot copy file " + file.sourceFN));
+            continue;
+        }
+        size = source.size();
+
+        bool sparse = false;
+#if defined(Q_OS_LINUX)
+        struct stat sourceStat;
+        sparse = fstat(source.handle(), &sourceStat) == 0 && qint64(sourceStat.st_blocks) * 512 < qint64(sourceStat.st_size);
+#endif
+
+        QByteArray fileMessage;
+        QDataStream fileOut(&fileMessage, QIODevice::WriteOnly);
+        fileOut.setVersion(AgentProtocol::STREAMVERSION);
+        fileOut << quint8(AgentProtocol::File) << file.targetFN << size << qint32(source.permissions()) << sparse;
+        if (!sendAgentMessage(fileMessage)) return false;
+
+        // only data regions are sent, the agent leaves holes of sparse files unwritten
+        qint64 offset = 0, dataStart, dataEnd, position;
+        while (complete && offset < size && nextDataRegion(source.handle(), offset, size, sparse, dataStart, dataEnd)) {
+            if (!source.seek(dataStart)) complete = false;
+            for (position = dataStart; complete && position < dataEnd; ) {
+                QByteArray block = source.read(qMin(qint64(AgentProtocol::DATABLOCK), dataEnd - position));
+                if (block.isEmpty()) {
+                    // the file was shortened meanwhile
+                    complete = source.error() == QFileDevice::NoError;
+                    dataEnd = size = position;
+                    break;
                 }
-                else {
-                    targetDir->mkdir(sourceFN);
-                    newDirectories++;
-                    if (!copyDirectories(sourceFileInfo.filePath(), targetFN, showDetails,
-                                         removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
-                                         newFiles, newFilesSize,
-                                         directoriesCount, newDirectories, removedDirectories))
-                        return false;
+
+                QByteArray dataMessage;
+                QDataStream dataOut(&dataMessage, QIODevice::WriteOnly);
+                dataOut.setVersion(AgentProtocol::STREAMVERSION);
+                dataOut << quint8(AgentProtocol::Data) << position << block;
+                if (!sendAgentMessage(dataMessage)) return false;
+                _physicalBytes += block.size();
+                position += block.size();
+            }
+            offset = dataEnd;
+        }
+
+        QByteArray endMessage;
+        QDataStream endOut(&endMessage, QIODevice::WriteOnly);
+        endOut.setVersion(AgentProtocol::STREAMVERSION);
+        endOut << quint8(AgentProtocol::FileEnd) << complete << size;
+        if (!sendAgentMessage(endMessage)) return false;
+
+        if (!complete) {
+            emit signalError(QString("Cannot copy file " + file.sourceFN));
+            continue;
+        }
+
+        rememberHardLink(key, links, file.targetFN);
+        _logicalBytes += size;
+        if (file.overwrite) {
+            overwrittenFilesSize += size;
+            overwrittenFiles++;
+            if (!showStatus(QString("overwrite " + file.targetFN), showDetails,
+                            removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                            newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)) return false;
+        }
+        else {
+            newFilesSize += size;
+            newFiles++;
+            if (!showStatus(QString("copy " + QFileInfo(file.sourceFN).fileName()), showDetails,
+                            removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                            newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories)) return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*!
+ * \brief Processes messages received from siba-agent.
+ * \param wait Block until at least one message is received.
+ * \return false if the connection failed or interruption is requested
+ */
+bool Copier::processAgentMessages(bool wait,
+                                  qint64 &removedFiles, qint64 &removedFilesSize,
+                                  qint64 &newDirectories, qint64 &removedDirectories)
+{
+    QByteArray message;
+
+    // reads available data and writes unsent data without blocking
+    _agent->waitForReadyRead(0);
+
+    forever {
+        while (AgentProtocol::readMessage(_agent, message)) {
+            if (!processAgentMessage(message, removedFiles, removedFilesSize, newDirectories, removedDirectories))
+                return false;
+            wait = false;
+        }
+        if (!wait) return true;
+        if (!waitAgent()) return false;
+    }
+}
+
+
+/*!
+ * \brief Processes one message received from siba-agent.
+ * \param message Message payload.
+ * \return false if the message is invalid
+ */
+bool Copier::processAgentMessage(const QByteArray &message,
+                                 qint64 &removedFiles, qint64 &removedFilesSize,
+                                 qint64 &newDirectories, qint64 &removedDirectories)
+{
+    QDataStream in(message);
+    quint8 type = 0;
+
+    in.setVersion(AgentProtocol::STREAMVERSION);
+    in >> type;
+
+    if (type == AgentProtocol::Need) {
+        quint64 batch;
+        QStringList names;
+        QList<bool> overwrite;
+
+        in >> batch >> names >> overwrite;
+        if (in.status() == QDataStream::Ok && _agentBatches.contains(batch) && names.size() == overwrite.size()) {
+            AgentBatch directory = _agentBatches.take(batch);
+            QSet<QString> needNames;
+            int i;
+            for (i = 0; i < names.size() && AgentProtocol::isValidName(names[i]); i++) {
+                _agentFiles.enqueue({directory.sourceDirectory + "/" + names[i], directory.targetDirectory + "/" + names[i], overwrite[i]});
+                needNames.insert(names[i]);
+            }
+            if (i == names.size()) {
+                // later links of unchanged source files are linked to the existing targets
+                for (const AgentLink &link : directory.links) {
+                    if (!needNames.contains(link.name))
+                        rememberHardLink(link.key, link.links, directory.targetDirectory + "/" + link.name);
                 }
+                return true;
             }
         }
     }
+    else if (type == AgentProtocol::Error) {
+        QString error;
+        in >> error;
+        emit signalError(error);
+        return true;
+    }
+    else if (type == AgentProtocol::Summary) {
+        qint64 agentRemovedFiles, agentRemovedFilesSize, agentNewDirectories, agentRemovedDirectories;
+        in >> agentRemovedFiles >> agentRemovedFilesSize >> agentNewDirectories >> agentRemovedDirectories;
+        if (in.status() == QDataStream::Ok) {
+            removedFiles += agentRemovedFiles;
+            removedFilesSize += agentRemovedFilesSize;
+            newDirectories += agentNewDirectories;
+            removedDirectories += agentRemovedDirectories;
+            _agentFinished = true;
+            return true;
+        }
+    }
 
+    emit signalError("Invalid message from agent");
+    return false;
+}
+
+
+/*!
+ * \brief Sends files requested for the last batches and collects statistics of siba-agent.
+ * \param showDetails Print detailed message.
+ * \return true if archiving was successful
+ */
+bool Copier::finishAgent(bool showDetails,
+                         qint64 &removedFiles, qint64 &removedFilesSize,
+                         qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
+                         qint64 &newFiles, qint64 &newFilesSize,
+                         qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories)
+{
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+
+    while (!_agentBatches.isEmpty()) {
+        if (!processAgentMessages(true, removedFiles, removedFilesSize, newDirectories, removedDirectories))
+            return false;
+        if (!sendAgentFiles(showDetails,
+                            removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
+                            newFiles, newFilesSize, directoriesCount, newDirectories, removedDirectories))
+            return false;
+    }
+
+    out.setVersion(AgentProtocol::STREAMVERSION);
+    out << quint8(AgentProtocol::End);
+    if (!sendAgentMessage(message)) return false;
+
+    _agentFinished = false;
+    while (!_agentFinished) {
+        if (!processAgentMessages(true, removedFiles, removedFilesSize, newDirectories, removedDirectories))
+            return false;
+    }
     return true;
 }
@@ -2,6 +2,18 @@
 #define COPIER_H
 
 #include <QThread>
+#include <QStack>
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QQueue>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include "flusher.h"
+
+class QDirIterator;
+class QIODevice;
 
 /*!
  * *****************************************************************
@@ -27,6 +39,17 @@ class Copier : public QThread
 {
     Q_OBJECT
 
+public:
+    /*!
+     * \brief When copied data are flushed to the target disk.
+     */
+    enum Durability {
+        DurabilityNone,         //!< the operating system flushes data on its own
+        DurabilityEndOfRun,     //!< one syncfs of the target file system at the end of backup
+        DurabilityPerDirectory, //!< batched fdatasync of files and fsync of each directory
+        DurabilityPerFile       //!< fdatasync of each file and fsync of its directory
+    };
+
 private:
     const char* SOURCEDIRID = "source.siba"; //!< the default name of source directory validation file
     const char* TARGETDIRID = "target.siba"; //!< the default name of target directory validation file
@@ -39,14 +62,116 @@ private:
     const qint64 MESSAGELIMITSECONDS = 3; //!< minimum time interval between subsequent messages
     qint64 lastMessageSeconds; //!< system time in seconds since the last displayed message
 
+    const int MESSAGEBATCH = 1024; //!< maximum number of detail messages sent in one batch
+    const qint64 MESSAGEBATCHMILLISECONDS = 100; //!< maximum delay of detail messages
+    QStringList _pendingMessages; //!< detail messages not sent yet
+    QElapsedTimer _messageTimer; //!< time since the last batch of detail messages
+
+    const qint64 DEFAULTMEMORYBUDGET = 16*1024*1024; //!< default memory budget of directory traversal in bytes
+    const qint64 ITERATORMEMORY = 48*1024; //!< estimated memory held by one open directory iterator
+    const qint64 HARDLINKMEMORY = 48; //!< estimated memory of one hard link entry without its path
+    const qint64 ENTRYCHUNK = 4096; //!< number of directory entries processed between status checks
+
+    /*!
+     * \brief One level of the directory traversal.
+     *
+     * Frames replace the recursion of the C++ stack. A frame keeps an open iterator
+     * over the source subdirectories. When the memory budget is exhausted,
+     * the iterator of a frame is released and reopened later after the last visited subdirectory.
+     */
+    struct DirectoryFrame {
+        QString sourceDirectory; //!< full path to source directory
+        QString targetDirectory; //!< full path to target directory
+        QDirIterator *iterator; //!< iterator over source subdirectories, nullptr if released
+        QString lastName; //!< name of the last visited subdirectory, empty if none
+        bool synchronized; //!< files and removed directories are already processed
+    };
+
+    qint64 _memoryBudget = DEFAULTMEMORYBUDGET; //!< maximum memory of directory traversal in bytes
+    qint64 _traversalMemory = 0; //!< current memory of directory traversal in bytes
+    qint64 _peakTraversalMemory = 0; //!< peak memory of directory traversal in bytes
+
+    const qint64 COPYBUFFERSIZE = 1024*1024; //!< size of file copy buffer in bytes
+    QByteArray _copyBuffer; //!< file copy buffer
+    qint64 _logicalBytes = 0; //!< size of copied files in bytes
+    qint64 _physicalBytes = 0; //!< bytes of data written to copied files, holes excluded
+
+    const int AGENTTIMEOUT = 30000; //!< maximum time to connect to the agent in milliseconds
+    const int AGENTPOLL = 500; //!< interval of interruption checks while waiting for the agent in milliseconds
+
+    typedef QPair<quint64, quint64> HardLinkKey; //!< device and inode of a source file
+
+    /*!
+     * \brief File requested by the agent.
+     */
+    struct AgentFile {
+        QString sourceFN; //!< full path to source file
+        QString targetFN; //!< path to target file relative to the target directory
+        bool overwrite; //!< the target file exists and is older
+    };
+
+    /*!
+     * \brief Multiply-linked source file listed in a directory batch.
+     */
+    struct AgentLink {
+        QString name; //!< file name
+        HardLinkKey key; //!< device and inode of the source file
+        quint32 links; //!< number of links of the source file
+    };
+
+    /*!
+     * \brief Directory batch waiting for reply of the agent.
+     */
+    struct AgentBatch {
+        QString sourceDirectory; //!< full path to source directory
+        QString targetDirectory; //!< path to target directory relative to the target directory of the agent
+        QList<AgentLink> links; //!< multiply-linked files of the batch, recorded if the agent does not request them
+    };
+
+    QIODevice *_agent = nullptr; //!< connection to siba-agent, nullptr for a local target
+    quint64 _agentBatch = 0; //!< id of the last directory batch sent to the agent
+    QHash<quint64, AgentBatch> _agentBatches; //!< batches waiting for reply
+    QQueue<AgentFile> _agentFiles; //!< files requested by the agent and not sent yet
+    bool _agentFinished = false; //!< the agent sent its summary
+
+    Durability _durability = DurabilityEndOfRun; //!< durability mode selected by the user
+    Durability _runDurability = DurabilityNone; //!< durability mode of the current backup, none if not supported
+    Flusher _flusher; //!< flushes copied data in the background
+    QStringList _durabilityFiles; //!< copied files of the current directory waiting for flush
+
+    /*!
+     * \brief Target of a source file with several hard links.
+     */
+    struct HardLink {
+        int path; //!< offset of the target file of the first visited link in the path pool
+        quint32 links; //!< number of links not visited yet
+    };
+
+    QHash<HardLinkKey, HardLink> _hardLinks; //!< multiply-linked source files, removed after the last link is visited
+    QByteArray _hardLinkPaths; //!< pool of encoded, zero-terminated target paths of hard links
+    int _freeHardLinkPaths = 0; //!< bytes of paths of removed entries in the pool
+    qint64 _hardLinkMemory = 0; //!< estimated memory of the hard link table, part of the traversal memory
+    bool _hardLinksLimited = false; //!< new hard links were not tracked because of the memory budget
+    qint64 _linkedFiles = 0; //!< number of files recreated as hard links
+
 public:
     explicit Copier(QObject *parent=nullptr);
     virtual ~Copier();
 
     void Setup(QString sourceDirectory, QString targetDirectory, bool validate, bool showDetails);
+    void setMemoryBudget(qint64 memoryBudget);
+    qint64 memoryBudget() const;
+    void setDurability(Durability durability);
+    Durability durability() const;
+    static qint64 peakMemoryUsage();
+    static bool isAgentTarget(QString targetDirectory);
+    static bool isDurabilitySupported(QString targetDirectory);
     virtual void run();
 
 protected:
+    void postMessage(QString message);
+    void flushMessages();
+
     bool showStatus(QString message, bool showDetails,
                     qint64 &removedFiles, qint64 &removedFilesSize,
                     qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
@@ -71,9 +196,57 @@ protected:
                                 qint64 &newFiles, qint64 &newFilesSize,
                                 qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories);
 
+    bool copyFile(QString sourceFN, QString targetFN);
+    bool copyOrLinkFile(QString sourceFN, QString targetFN);
+    static bool nextDataRegion(int fd, qint64 offset, qint64 size, bool &sparse, qint64 &dataStart, qint64 &dataEnd);
+    QString hardLinkTarget(QString sourceFN, HardLinkKey &key, quint32 &links);
+    void rememberHardLink(const HardLinkKey &key, quint32 links, QString targetFN);
+    void compactHardLinkPaths();
+    void updateHardLinkMemory();
+    void scheduleFlush(QString targetFN);
+    void flushDirectoryFiles();
+
+    bool connectAgent(QString target);
+    void disconnectAgent();
+    bool isAgentConnected() const;
+    bool waitAgent();
+    bool sendAgentMessage(const QByteArray &message);
+
+    bool sendDirectory(QString sourceDirectory, QString targetDirectory, bool showDetails,
+                       qint64 &removedFiles, qint64 &removedFilesSize,
+                       qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
+                       qint64 &newFiles, qint64 &newFilesSize,
+                       qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories);
+
+    bool sendAgentFiles(bool showDetails,
+                        qint64 &removedFiles, qint64 &removedFilesSize,
+                        qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
+                        qint64 &newFiles, qint64 &newFilesSize,
+                        qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories);
+
+    bool processAgentMessages(bool wait,
+                              qint64 &removedFiles, qint64 &removedFilesSize,
+                              qint64 &newDirectories, qint64 &removedDirectories);
+
+    bool processAgentMessage(const QByteArray &message,
+                             qint64 &removedFiles, qint64 &removedFilesSize,
+                             qint64 &newDirectories, qint64 &removedDirectories);
+
+    bool finishAgent(bool showDetails,
+                     qint64 &removedFiles, qint64 &removedFilesSize,
+                     qint64 &overwrittenFiles, qint64 &overwrittenFilesSize,
+                     qint64 &newFiles, qint64 &newFilesSize,
+                     qint64 &directoriesCount, qint64 &newDirectories, qint64 &removedDirectories);
+
+    bool nextDirectory(QStack<DirectoryFrame> &frames, QString &sourceDirectory, QString &targetDirectory);
+    void openFrame(QStack<DirectoryFrame> &frames, DirectoryFrame &frame);
+    void closeFrame(DirectoryFrame &frame);
+    qint64 frameMemory(const DirectoryFrame &frame) const;
+
 signals:
     void signalError(QString message);
     void signalMessage(QString message);
+    void signalMessages(QStringList messages);
     void signalStatus(QString message,
                       qint64 removedFiles, qint64 removedFilesSize,
                       qint64 overwrittenFiles, qint64 overwrittenFilesSize,
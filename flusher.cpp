@@ -0,0 +1,239 @@
+#include <QFile>
+#include <QElapsedTimer>
+#include <QVector>
+
+#if defined(Q_OS_UNIX)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "flusher.h"
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file flusher.cpp
+ *
+ * \brief Flusher class implemenation.
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+Flusher::Flusher(QObject *parent) : QThread(parent)
+{
+}
+
+Flusher::~Flusher()
+{
+    if (isRunning()) finish();
+}
+
+
+/*!
+ * \brief Resets statistics and starts the flushing thread.
+ */
+void Flusher::begin()
+{
+    QMutexLocker locker(&_mutex);
+
+    _queue.clear();
+    _stopping = false;
+    _waitMilliseconds = 0;
+    _flushMilliseconds = 0;
+    locker.unlock();
+
+    start();
+}
+
+
+/*!
+ * \brief Queues a flush request, blocks while the queue is full.
+ * \param request Type of request.
+ * \param paths Full paths of files, or a single directory.
+ */
+void Flusher::enqueue(Request request, QStringList paths)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (QUEUELIMIT <= _queue.size()) {
+        QElapsedTimer timer;
+        timer.start();
+        while (QUEUELIMIT <= _queue.size()) _queueChanged.wait(&_mutex);
+        _waitMilliseconds += timer.elapsed();
+    }
+
+    _queue.enqueue({request, paths});
+    _queueChanged.wakeAll();
+}
+
+
+/*!
+ * \brief Waits until all queued requests are processed and stops the thread.
+ */
+void Flusher::finish()
+{
+    QElapsedTimer timer;
+
+    timer.start();
+    _mutex.lock();
+    _stopping = true;
+    _queueChanged.wakeAll();
+    _mutex.unlock();
+
+    wait();
+
+    _mutex.lock();
+    _waitMilliseconds += timer.elapsed();
+    _mutex.unlock();
+}
+
+
+/*!
+ * \brief Returns the time the copier waited for flushing in milliseconds.
+ */
+qint64 Flusher::waitMilliseconds()
+{
+    QMutexLocker locker(&_mutex);
+    return _waitMilliseconds;
+}
+
+
+/*!
+ * \brief Returns the time spent flushing in milliseconds.
+ */
+qint64 Flusher::flushMilliseconds()
+{
+    QMutexLocker locker(&_mutex);
+    return _flushMilliseconds;
+}
+
+
+/*!
+ * \brief Processes queued requests until finish is called and the queue is empty.
+ *
+ * Consecutive requests to flush the same directory are merged.
+ */
+void Flusher::run()
+{
+    QElapsedTimer timer;
+    Item item;
+
+    forever {
+        _mutex.lock();
+        while (_queue.isEmpty() && !_stopping) _queueChanged.wait(&_mutex);
+        if (_queue.isEmpty()) {
+            _mutex.unlock();
+            return;
+        }
+
+        item = _queue.dequeue();
+        while (item.request == SyncDirectory && !_queue.isEmpty()
+               && _queue.head().request == SyncDirectory && _queue.head().paths == item.paths) {
+            _queue.dequeue();
+        }
+        _queueChanged.wakeAll();
+        _mutex.unlock();
+
+        timer.start();
+        process(item);
+
+        _mutex.lock();
+        _flushMilliseconds += timer.elapsed();
+        _mutex.unlock();
+    }
+}
+
+
+/*!
+ * \brief Flushes files, a directory or a file system.
+ * \param item Flush request.
+ */
+void Flusher::process(const Item &item)
+{
+#if defined(Q_OS_UNIX)
+    QVector<int> fds;
+    int fd;
+
+    if (item.request == SyncFiles) {
+        // start writeback of all files before waiting for any of them
+        fds.resize(item.paths.size());
+        for (int i = 0; i < item.paths.size(); i++) {
+            fds[i] = openFile(item.paths[i]);
+            if (fds[i] < 0) emit signalError("Cannot flush file " + item.paths[i]);
+#if defined(Q_OS_LINUX)
+            else sync_file_range(fds[i], 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+        }
+
+        for (int i = 0; i < fds.size(); i++) {
+            if (fds[i] < 0) continue;
+#if defined(Q_OS_LINUX)
+            if (fdatasync(fds[i]) != 0) emit signalError("Cannot flush file " + item.paths[i]);
+#else
+            if (fsync(fds[i]) != 0) emit signalError("Cannot flush file " + item.paths[i]);
+#endif
+            ::close(fds[i]);
+        }
+        return;
+    }
+
+    fd = ::open(QFile::encodeName(item.paths.first()).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        emit signalError("Cannot flush directory " + item.paths.first());
+        return;
+    }
+
+    if (item.request == SyncDirectory) {
+        if (fsync(fd) != 0) emit signalError("Cannot flush directory " + item.paths.first());
+    }
+    else {
+#if defined(Q_OS_LINUX)
+        if (syncfs(fd) != 0) emit signalError("Cannot flush file system of " + item.paths.first());
+#else
+        sync();
+#endif
+    }
+    ::close(fd);
+#else
+    Q_UNUSED(item)
+#endif
+}
+
+
+/*!
+ * \brief Opens a copied file for flushing.
+ * \param path Full path to file.
+ * \return file descriptor, -1 if the file cannot be opened
+ *
+ * Copied files keep the permissions of source files. A file the owner cannot read,
+ * e.g. mode 0200, is opened with the read permission added for a moment,
+ * the original mode is restored before the file is flushed.
+ */
+int Flusher::openFile(QString path)
+{
+#if defined(Q_OS_UNIX)
+    QByteArray name = QFile::encodeName(path);
+    struct stat fileStat;
+    int fd;
+
+    fd = ::open(name.constData(), O_RDONLY | O_CLOEXEC);
+    if (0 <= fd || errno != EACCES) return fd;
+
+    if (::stat(name.constData(), &fileStat) != 0) return -1;
+    if (::chmod(name.constData(), (fileStat.st_mode & 07777) | S_IRUSR) != 0) return -1;
+    fd = ::open(name.constData(), O_RDONLY | O_CLOEXEC);
+    if (::chmod(name.constData(), fileStat.st_mode & 07777) != 0) emit signalError("Cannot restore permissions of " + path);
+    return fd;
+#else
+    Q_UNUSED(path)
+    return -1;
+#endif
+}
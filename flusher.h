@@ -0,0 +1,79 @@
+#ifndef FLUSHER_H
+#define FLUSHER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QStringList>
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file flusher.h
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief The Flusher class, flushes copied data to disk in the background.
+ *
+ * Requests are queued by Copier and processed in a separate thread,
+ * so flushing overlaps with further copying. Copier waits only when
+ * the queue is full and when the backup finishes.
+ */
+class Flusher : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Request {
+        SyncFiles,      //!< flush data of files, writeback of the whole batch is started first
+        SyncDirectory,  //!< flush directory entries
+        SyncFileSystem  //!< flush the whole file system of the path
+    };
+
+    static const int BATCHSIZE = 256; //!< maximum number of files in one SyncFiles request
+
+private:
+    const int QUEUELIMIT = 64; //!< maximum number of queued requests
+
+    struct Item {
+        Request request; //!< type of request
+        QStringList paths; //!< full paths of files or directory
+    };
+
+    QMutex _mutex; //!< guards the queue and the statistics
+    QWaitCondition _queueChanged; //!< signalled when a request is queued or taken
+    QQueue<Item> _queue; //!< pending requests
+    bool _stopping = false; //!< no more requests will be queued
+    qint64 _waitMilliseconds = 0; //!< time the copier waited for flushing
+    qint64 _flushMilliseconds = 0; //!< time spent flushing
+
+public:
+    explicit Flusher(QObject *parent=nullptr);
+    virtual ~Flusher();
+
+    void begin();
+    void enqueue(Request request, QStringList paths);
+    void finish();
+
+    qint64 waitMilliseconds();
+    qint64 flushMilliseconds();
+
+protected:
+    virtual void run();
+    void process(const Item &item);
+    int openFile(QString path);
+
+signals:
+    void signalError(QString message);
+};
+
+#endif // FLUSHER_H
@@ -0,0 +1,154 @@
+#include "logmodel.h"
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file logmodel.cpp
+ *
+ * \brief LogModel class implemenation.
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief Creates an empty log.
+ * \param capacity Maximum number of lines kept.
+ * \param overflow Lines dropped when the log is full.
+ * \param parent Parent object.
+ */
+LogModel::LogModel(int capacity, Overflow overflow, QObject *parent) : QAbstractListModel(parent)
+{
+    _overflow = overflow;
+    _lines.resize(qMax(1, capacity));
+    _refreshTimer.setInterval(REFRESHMILLISECONDS);
+    _refreshTimer.setSingleShot(true);
+    connect(&_refreshTimer, &QTimer::timeout, this, &LogModel::refresh);
+}
+
+
+/*!
+ * \brief Returns the number of lines in the log.
+ */
+int LogModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) return 0;
+    return _count;
+}
+
+
+/*!
+ * \brief Returns the line of the log.
+ */
+QVariant LogModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || _count <= index.row() || role != Qt::DisplayRole) return QVariant();
+    return _lines[(_first + index.row()) % _lines.size()];
+}
+
+
+/*!
+ * \brief Appends a line, the line is shown on the next refresh.
+ * \param line Log line.
+ */
+void LogModel::append(QString line)
+{
+    _pendingLines << line;
+    if (!_refreshTimer.isActive()) _refreshTimer.start();
+}
+
+
+/*!
+ * \brief Appends lines, the lines are shown on the next refresh.
+ * \param lines Log lines.
+ */
+void LogModel::append(QStringList lines)
+{
+    _pendingLines << lines;
+    if (!_refreshTimer.isActive()) _refreshTimer.start();
+}
+
+
+/*!
+ * \brief Removes all lines.
+ */
+void LogModel::clear()
+{
+    beginResetModel();
+    _first = 0;
+    _count = 0;
+    _droppedLines = 0;
+    _pendingLines.clear();
+    for (int i = 0; i < _lines.size(); i++) _lines[i].clear();
+    endResetModel();
+    _refreshTimer.stop();
+}
+
+
+/*!
+ * \brief Returns the maximum number of lines kept.
+ */
+int LogModel::capacity() const
+{
+    return _lines.size();
+}
+
+
+/*!
+ * \brief Returns the number of lines dropped or not kept since the last clear.
+ */
+qint64 LogModel::droppedLines() const
+{
+    return _droppedLines;
+}
+
+
+/*!
+ * \brief Inserts pending lines in one batch, lines that do not fit are dropped.
+ */
+void LogModel::refresh()
+{
+    int capacity = _lines.size();
+    int skipped, dropped, inserted;
+
+    if (_pendingLines.isEmpty()) return;
+
+    if (_overflow == DropNewest) {
+        inserted = qMin(_pendingLines.size(), capacity - _count);
+        if (0 < inserted) {
+            beginInsertRows(QModelIndex(), _count, _count + inserted - 1);
+            for (int i = 0; i < inserted; i++) _lines[(_first + _count + i) % capacity] = _pendingLines[i];
+            _count += inserted;
+            endInsertRows();
+        }
+        _droppedLines += _pendingLines.size() - inserted;
+        _pendingLines.clear();
+        return;
+    }
+
+    // lines that would be dropped immediately are not inserted at all
+    skipped = qMax(0, _pendingLines.size() - capacity);
+    inserted = _pendingLines.size() - skipped;
+    dropped = qMax(0, _count + inserted - capacity);
+
+    if (0 < dropped) {
+        beginRemoveRows(QModelIndex(), 0, dropped - 1);
+        for (int i = 0; i < dropped; i++) _lines[(_first + i) % capacity].clear();
+        _first = (_first + dropped) % capacity;
+        _count -= dropped;
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), _count, _count + inserted - 1);
+    for (int i = 0; i < inserted; i++) _lines[(_first + _count + i) % capacity] = _pendingLines[skipped + i];
+    _count += inserted;
+    endInsertRows();
+
+    _droppedLines += skipped + dropped;
+    _pendingLines.clear();
+}
@@ -0,0 +1,69 @@
+#ifndef LOGMODEL_H
+#define LOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QVector>
+#include <QTimer>
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file logmodel.h
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ * *****************************************************************
+ */
+
+
+/*!
+ * \brief The LogModel class, log lines for a list view.
+ *
+ * Lines are kept in a ring buffer of fixed capacity. When it is full, either the oldest lines
+ * are dropped, or new lines are only counted and the first lines are kept.
+ * Appended lines are collected and inserted into the model in one batch
+ * on a refresh timer, so views are updated a few times per second at most.
+ */
+class LogModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Overflow {
+        DropOldest, //!< the oldest lines are dropped
+        DropNewest  //!< new lines are counted but not kept
+    };
+
+private:
+    const int REFRESHMILLISECONDS = 100; //!< interval of inserting appended lines
+
+    QVector<QString> _lines; //!< ring buffer of lines
+    int _first = 0; //!< index of the oldest line in the ring buffer
+    int _count = 0; //!< number of lines in the ring buffer
+    qint64 _droppedLines = 0; //!< number of lines dropped or not kept
+    Overflow _overflow; //!< lines dropped when the ring buffer is full
+    QStringList _pendingLines; //!< appended lines not inserted yet
+    QTimer _refreshTimer; //!< inserts pending lines
+
+public:
+    explicit LogModel(int capacity, Overflow overflow=DropOldest, QObject *parent=nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void append(QString line);
+    void append(QStringList lines);
+    void clear();
+
+    int capacity() const;
+    qint64 droppedLines() const;
+
+public slots:
+    void refresh();
+};
+
+#endif // LOGMODEL_H
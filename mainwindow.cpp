@@ -3,6 +3,7 @@
 #include <QFileDialog>
 #include <QDir>
 #include <QDateTime>
+#include <QScrollBar>
 #include <Qt>
 
 /*!
@@ -37,10 +38,47 @@
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    on_tbTargetDir_textChanged(ui->tbTargetDir->text());
+
+    _messageLog = new LogModel(MESSAGECAPACITY, LogModel::DropOldest, this);
+    // the first errors are usually the cause of the following ones
+    _errorLog = new LogModel(ERRORCAPACITY, LogModel::DropNewest, this);
+    _messageFilter = new QSortFilterProxyModel(this);
+    _messageFilter->setSourceModel(_messageLog);
+    _messageFilter->setFilterCaseSensitivity(Qt::CaseInsensitive);
+    // dropped messages are not written anywhere else, so the filter cannot find them
+    ui->tbFilter->setToolTip(QString("shows messages containing the text, only the last %1 messages are searched")
+                             .arg(MESSAGECAPACITY));
+
+    // uniform rows let the views lay out only the visible lines
+    ui->lvMessage->setModel(_messageFilter);
+    ui->lvMessage->setUniformItemSizes(true);
+    ui->lvError->setModel(_errorLog);
+    ui->lvError->setUniformItemSizes(true);
+
+    // views follow new lines only while they show the last line, so the log can be read during backup
+    connect(_messageLog, &QAbstractItemModel::rowsAboutToBeInserted, this, [this]() { _followMessages = isScrolledToEnd(ui->lvMessage); });
+    connect(_messageLog, &QAbstractItemModel::rowsInserted, this, [this]() { if (_followMessages) ui->lvMessage->scrollToBottom(); });
+    connect(_errorLog, &QAbstractItemModel::rowsAboutToBeInserted, this, [this]() { _followErrors = isScrolledToEnd(ui->lvError); });
+    connect(_errorLog, &QAbstractItemModel::rowsInserted, this, [this]() { if (_followErrors) ui->lvError->scrollToBottom(); });
+
+    _messageLog->append(QStringList()
+                        << "THE DISCLAIMER"
+                        << ""
+                        << "The software is provided \"as is\", without warranty of any kind."
+                        << ""
+                        << "You use the software at your own risk."
+                        << ""
+                        << "The software is a work in progress and may contain some defects."
+                        << "We do not guarantee that the software will be error-free, the results obtained from the use of the software will be accurate and reliable."
+                        << ""
+                        << "We will not be liable for any direct or indirect damages resulting from the use or misuse of the software,"
+                        << "even if the author has been advised of the possibility of such damage.");
 
     connect(&_copier, &QThread::finished, this, &MainWindow::threadFinished);
     connect(&_copier, &Copier::signalError, this, &MainWindow::showError);
     connect(&_copier, &Copier::signalMessage, this, &MainWindow::showMessage);
+    connect(&_copier, &Copier::signalMessages, this, &MainWindow::showMessages);
     connect(&_copier, &Copier::signalStatus, this, &MainWindow::showStatus);
     connect(&_copier, &Copier::signalBackupFinished, this, &MainWindow::backupFinished);
 }
@@ -83,6 +121,24 @@ void MainWindow::on_btnBrowseTargetDir_clicked()
 }
 
 
+/*!
+ * \brief Disables the durability modes if the target cannot be flushed.
+ * \param text Target directory or agent address.
+ */
+void MainWindow::on_tbTargetDir_textChanged(const QString &text)
+{
+    bool supported = Copier::isDurabilitySupported(text);
+
+    ui->cbDurability->setEnabled(supported);
+    if (supported)
+        ui->cbDurability->setToolTip(QString());
+    else if (Copier::isAgentTarget(text))
+        ui->cbDurability->setToolTip("siba-agent targets are not flushed to disk");
+    else
+        ui->cbDurability->setToolTip("flushing to disk is not supported on this platform");
+}
+
+
 /*!
  * \brief Reads input parameters and runs backup.
  */
@@ -98,16 +154,18 @@ void MainWindow::on_btnRun_clicked()
     enableControls(false);
     ui->btnCancel->setText("Cancel");
 
-    ui->txtMessage->setText(nullptr);
-    ui->txtError->setText(nullptr);
-    _msgCount = 0;
+    _messageLog->clear();
+    _errorLog->clear();
 
     sourceDirectory = ui->tbSourceDir->text();
     targetDirectory = ui->tbTargetDir->text();
 
     validate = ui->chbValidateArchive->isChecked();
+    _printDetails = ui->chbShowDetails->isChecked();
 
     _copier.Setup(sourceDirectory, targetDirectory, validate, _printDetails);
+    _copier.setDurability(Copier::Durability(ui->cbDurability->currentIndex()));
+    _copier.setMemoryBudget(qint64(ui->sbMemoryBudget->value())*1024*1024);
 
     _copier.start();
 }
@@ -142,42 +200,64 @@ void MainWindow::enableControls(bool enabled)
     ui->btnBrowseTargetDir->setEnabled(enabled);
     ui->tbSourceDir->setEnabled(enabled);
     ui->tbTargetDir->setEnabled(enabled);
+    ui->cbDurability->setEnabled(enabled && Copier::isDurabilitySupported(ui->tbTargetDir->text()));
+    ui->sbMemoryBudget->setEnabled(enabled);
+    ui->chbShowDetails->setEnabled(enabled);
+}
+
+
+/*!
+ * \brief Checks if the view shows the last line.
+ * \param view List view.
+ * \return true if the vertical scroll bar is at its maximum
+ */
+bool MainWindow::isScrolledToEnd(QAbstractItemView *view)
+{
+    return view->verticalScrollBar()->value() == view->verticalScrollBar()->maximum();
 }
 
 
 /*!
  * \fn MainWindow::showMessage(QString message)
- * \brief append message in the error text box
+ * \brief append message in the error log
  * \param message: error message to display
  */
 void MainWindow::showError(QString message)
 {
-    ui->txtError->append(message);
-    QTextCursor textCursor = ui->txtError->textCursor();
-    textCursor.movePosition(QTextCursor::End, QTextCursor::MoveAnchor,1);
-    ui->txtError->setTextCursor(textCursor);
+    _errorLog->append(message);
 }
 
 
 /*!
  * \fn MainWindow::showMessage(QString msg, bool print)
- * \brief append message in the message text box
+ * \brief append message in the message log, the log is refreshed periodically
  * \param message: message to display
  */
 void MainWindow::showMessage(QString message)
 {
-    if (MESSAGELIMIT <= _msgCount) {
-        ui->txtMessage->setText(message);
-        _msgCount = 0;
-    }
-    else {
-        ui->txtMessage->append(message);
-        _msgCount++;
-        QTextCursor textCursor = ui->txtMessage->textCursor();
-        textCursor.movePosition(QTextCursor::End, QTextCursor::MoveAnchor,1);
-        ui->txtMessage->setTextCursor(textCursor);
-    }
-    //QApplication::processEvents();
+    _messageLog->append(message);
+}
+
+
+/*!
+ * \brief Appends a batch of detail messages in the message log.
+ * \param messages Messages to display.
+ */
+void MainWindow::showMessages(QStringList messages)
+{
+    _messageLog->append(messages);
+}
+
+
+/*!
+ * \brief Shows only messages containing the filter text.
+ * \param text Filter text, empty text shows all messages.
+ *
+ * Only messages kept in the log are searched, the oldest messages of a long backup are dropped.
+ */
+void MainWindow::on_tbFilter_textChanged(const QString &text)
+{
+    _messageFilter->setFilterFixedString(text);
 }
 
 
@@ -200,7 +280,7 @@ void MainWindow::showStatus(QString message,
                             qint64 newFiles, qint64 newFilesSize,
                             qint64 directoriesCount, qint64 newDirectories, qint64 removedDirectories)
 {
-    showMessage(message);
+    if (!message.isEmpty()) showMessage(message);
     showStatistics(removedFiles, removedFilesSize, overwrittenFiles, overwrittenFilesSize,
                    newFiles, newFilesSize,
                    directoriesCount, newDirectories, removedDirectories);
@@ -276,10 +356,19 @@ void MainWindow::backupFinished(qint64 removedFiles, qint64 removedFilesSize,
     showMessage("Removed files: " + getStatString(removedFiles, removedFilesSize));
     showMessage("");
 
+    _messageLog->refresh();
+    if (0 < _messageLog->droppedLines())
+        showMessage(QString("%1 oldest messages were dropped from the log, the filter does not find them")
+                    .arg(_messageLog->droppedLines()));
+    _errorLog->refresh();
+    if (0 < _errorLog->droppedLines())
+        showMessage(QString("%1 errors were not kept, the error log shows the first %2 errors")
+                    .arg(_errorLog->droppedLines()).arg(_errorLog->capacity()));
+
     if (_copier.isInterruptionRequested())
-        showMessage("\n*** Cancelled by user ***");
+        showMessage("*** Cancelled by user ***");
     else
-        showMessage("\n*** Finished ***");
+        showMessage("*** Finished ***");
 }
 
 
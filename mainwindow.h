@@ -2,7 +2,10 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QSortFilterProxyModel>
+#include <QAbstractItemView>
 #include "copier.h"
+#include "logmodel.h"
 
 /*!
  * *****************************************************************
@@ -28,12 +31,18 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 private:
-    const int MESSAGELIMIT = 1024;
-    int _msgCount = 0;
+    const int MESSAGECAPACITY = 100000; //!< maximum number of lines in the message log
+    const int ERRORCAPACITY = 10000; //!< maximum number of lines in the error log, further errors are only counted
 
     bool _printDetails = false;
     Copier _copier;
 
+    LogModel *_messageLog; //!< messages of the backup
+    LogModel *_errorLog; //!< first errors of the backup, kept apart from messages
+    QSortFilterProxyModel *_messageFilter; //!< messages matching the filter
+    bool _followMessages = true; //!< the message view showed the last line before new lines were inserted
+    bool _followErrors = true; //!< the error view showed the last line before new lines were inserted
+
 public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
@@ -41,14 +50,17 @@ public:
 private slots:
     void on_btnBrowseSourceDir_clicked();
     void on_btnBrowseTargetDir_clicked();
+    void on_tbTargetDir_textChanged(const QString &text);
     void on_btnRun_clicked();
     void on_btnCancel_clicked();
+    void on_tbFilter_textChanged(const QString &text);
 
 private:
     Ui::MainWindow *ui;
 
 protected:
     void enableControls(bool enabled);
+    static bool isScrolledToEnd(QAbstractItemView *view);
 
     QString getStatString(qint64 fileCount, qint64 fileSize);
     void showStatistics(qint64 removedFiles, qint64 removedFilesSize,
@@ -59,6 +71,7 @@ protected:
 public slots:
     void showError(QString message);
     void showMessage(QString message);
+    void showMessages(QStringList messages);
     void showStatus(QString message,
                     qint64 removedFiles, qint64 removedFilesSize,
                     qint64 overwrittenFiles, qint64 overwrittenFilesSize,
@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# siba-agent, receives backups sent by SiBa
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = siba-agent
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+
+# the agent can be built in the same directory as SiBa
+MAKEFILE = Makefile.siba-agent
+OBJECTS_DIR = siba-agent.obj
+MOC_DIR = siba-agent.moc
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+
+SOURCES += \
+        agent.cpp \
+        agentmain.cpp \
+        agentprotocol.cpp
+
+HEADERS += \
+        agent.h \
+        agentprotocol.h
@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# agenttest, runs Copier without the user interface
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = agenttest
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$PWD/../..
+
+
+SOURCES += \
+        main.cpp \
+        $$PWD/../../agentprotocol.cpp \
+        $$PWD/../../copier.cpp \
+        $$PWD/../../flusher.cpp
+
+HEADERS += \
+        $$PWD/../../agentprotocol.h \
+        $$PWD/../../copier.h \
+        $$PWD/../../flusher.h
+
+win32: LIBS += -lpsapi
@@ -0,0 +1,154 @@
+#!/bin/bash
+#
+# *****************************************************************
+#                               SiBa
+# *****************************************************************
+# local.sh
+#
+# Builds agenttest without compiler warnings and backs up generated source trees to a local target
+# directory, the target tree is compared with the source tree after each run.
+#
+# A deep and wide tree is copied with a memory budget of 1 byte, so the iterator
+# of every directory is released and reopened after each subdirectory.
+#
+# A sparse file with a data block in the middle and a trailing hole is copied,
+# the copy must be identical and keep its holes.
+#
+# A multiply-linked file is linked in the target, with a memory budget of 1 byte
+# the hard link table is not filled and the links are copied as separate files.
+#
+# Environment: QMAKE (default qmake), BUILD (build directory, default temporary),
+# KEEP=1 keeps the working directory.
+#
+# Source: https:\\github.com/milan-koren/SiBa
+# Licence: EUPL v. 1.2
+# *****************************************************************
+
+set -eu
+
+REPO=$(cd "$(dirname "$0")/../.." && pwd)
+QMAKE=${QMAKE:-qmake}
+WORK=$(mktemp -d)
+BUILD=${BUILD:-$WORK/build}
+
+cleanup() {
+    if [ "${KEEP:-0}" = 1 ]; then echo "kept $WORK"; else rm -rf "$WORK"; fi
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+
+# ---- build
+
+mkdir -p "$BUILD/agenttest"
+(cd "$BUILD/agenttest" && "$QMAKE" "$REPO/tests/agent/agenttest.pro" && make -j"$(nproc)") >"$BUILD/agenttest.log" 2>&1 \
+    || { tail -n 50 "$BUILD/agenttest.log" >&2; fail "build of agenttest"; }
+grep -i "warning:" "$BUILD/agenttest.log" >&2 && fail "build of agenttest has warnings"
+COPIER=$BUILD/agenttest/agenttest
+
+
+# ---- checks
+
+new_tree() {
+    rm -rf "$1"
+    mkdir -p "$1"
+    touch "$1/$2"
+}
+
+backup() {
+    "$COPIER" "$@" >"$WORK/copier.log" 2>&1 || { cat "$WORK/copier.log" >&2; fail "backup to ${*: -1}"; }
+}
+
+compare() {
+    diff -r --no-dereference -x source.siba -x target.siba "$1" "$2" >"$WORK/diff.txt" \
+        || { head -n 20 "$WORK/diff.txt" >&2; fail "$2 differs from $1"; }
+}
+
+
+# ---- deep tree with a tiny memory budget
+
+SOURCE=$WORK/deep
+TARGET=$WORK/deep-target
+new_tree "$SOURCE" source.siba
+new_tree "$TARGET" target.siba
+
+make_level() {
+    local directory=$1 depth=$2
+    echo "$directory" >"$directory/file.txt"
+    [ "$depth" = 0 ] && return
+    for name in d1 d2 d3; do
+        mkdir "$directory/$name"
+        make_level "$directory/$name" $((depth - 1))
+    done
+}
+make_level "$SOURCE" 5
+CHAIN=$SOURCE/chain
+for i in $(seq 1 60); do CHAIN=$CHAIN/c$i; done
+mkdir -p "$CHAIN"
+echo bottom >"$CHAIN/bottom.txt"
+
+backup --memory 1 "$SOURCE" "$TARGET"
+compare "$SOURCE" "$TARGET"
+echo "deep tree: new tree ok"
+
+rm -r "$SOURCE/d2/d2" "$SOURCE/d3/d1/d1"
+mkdir -p "$SOURCE/d1/d4/e1" "$SOURCE/d3/d1/d4"
+echo new >"$SOURCE/d1/d4/e1/new.txt"
+backup --memory 1 "$SOURCE" "$TARGET"
+compare "$SOURCE" "$TARGET"
+grep -q "visited again" "$WORK/copier.log" && fail "subdirectories were visited again in an unchanged tree"
+echo "deep tree: modified tree ok"
+
+
+# ---- sparse file
+
+SOURCE=$WORK/sparse
+TARGET=$WORK/sparse-target
+new_tree "$SOURCE" source.siba
+new_tree "$TARGET" target.siba
+
+truncate -s 64M "$SOURCE/image.bin"
+dd if=/dev/urandom of="$SOURCE/image.bin" bs=1M count=1 seek=20 conv=notrunc status=none
+echo small >"$SOURCE/small.txt"
+
+if [ "$(du -k "$SOURCE/image.bin" | cut -f1)" -ge 8192 ]; then
+    echo "sparse file: skipped, the file system of $WORK does not support holes"
+else
+    backup "$SOURCE" "$TARGET"
+    compare "$SOURCE" "$TARGET"
+    cmp "$SOURCE/image.bin" "$TARGET/image.bin" || fail "sparse file differs"
+    [ "$(stat -c %s "$TARGET/image.bin")" = $((64 * 1024 * 1024)) ] || fail "size of sparse file differs"
+    [ "$(du -k "$TARGET/image.bin" | cut -f1)" -lt 8192 ] || fail "holes of sparse file were filled"
+    echo "sparse file: ok"
+fi
+
+# ---- hard links with the default and with a tiny memory budget
+
+SOURCE=$WORK/links
+TARGET=$WORK/links-target
+new_tree "$SOURCE" source.siba
+new_tree "$TARGET" target.siba
+
+mkdir "$SOURCE/a" "$SOURCE/b"
+echo linked >"$SOURCE/a/linked.txt"
+ln "$SOURCE/a/linked.txt" "$SOURCE/b/linked.txt"
+
+backup "$SOURCE" "$TARGET"
+compare "$SOURCE" "$TARGET"
+[ "$(stat -c %i "$TARGET/a/linked.txt")" = "$(stat -c %i "$TARGET/b/linked.txt")" ] \
+    || fail "hard link was not recreated"
+echo "hard links: linked ok"
+
+TARGET=$WORK/links-limited
+new_tree "$TARGET" target.siba
+backup --memory 1 "$SOURCE" "$TARGET"
+compare "$SOURCE" "$TARGET"
+grep -q "Memory budget of hard links exceeded" "$WORK/copier.log" \
+    || fail "hard links were tracked beyond the memory budget"
+echo "hard links: copied over budget ok"
+
+echo "PASS"
@@ -0,0 +1,82 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <stdio.h>
+
+#include "copier.h"
+
+/*!
+ * *****************************************************************
+ *                               SiBa
+ * *****************************************************************
+ * \file main.cpp
+ *
+ * \brief agenttest, runs one backup by Copier without the user interface.
+ *
+ * \author M. Koren, milan.koren3@gmail.com
+ * Source: https:\\github.com/milan-koren/SiBa
+ * Licence: EUPL v. 1.2
+ * https://joinup.ec.europa.eu/collection/eupl
+ *
+ * agenttest [--memory bytes] [--durability mode] source target
+ *
+ * The target is a local directory or a siba-agent address. Source and target are validated.
+ * The memory budget of directory traversal and the durability mode (0 none, 1 end of run,
+ * 2 each directory, 3 each file) are passed to Copier, durability is none by default.
+ * Messages are printed to the standard output, errors to the standard error.
+ * The exit code is 1 if any error was reported.
+ * *****************************************************************
+ */
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    Copier copier;
+    int errors = 0;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs one backup by Copier without the user interface.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("source", "Source directory.");
+    parser.addPositionalArgument("target", "Target directory or siba-agent address.");
+
+    QCommandLineOption memoryOption("memory", "Memory budget of directory traversal in bytes.", "bytes");
+    QCommandLineOption durabilityOption("durability", "Durability mode.", "mode", "0");
+    parser.addOption(memoryOption);
+    parser.addOption(durabilityOption);
+    parser.process(a);
+
+    QStringList arguments = parser.positionalArguments();
+    if (arguments.size() != 2) parser.showHelp(2);
+
+    QObject::connect(&copier, &Copier::signalError, &a, [&errors](QString message) {
+        errors++;
+        fprintf(stderr, "error: %s\n", qPrintable(message));
+    });
+    QObject::connect(&copier, &Copier::signalMessage, &a, [](QString message) {
+        printf("%s\n", qPrintable(message));
+    });
+    QObject::connect(&copier, &Copier::signalBackupFinished, &a,
+                     [](qint64 removedFiles, qint64 removedFilesSize,
+                        qint64 overwrittenFiles, qint64 overwrittenFilesSize,
+                        qint64 newFiles, qint64 newFilesSize,
+                        qint64 directoriesCount, qint64 newDirectories, qint64 removedDirectories) {
+        Q_UNUSED(removedFilesSize)
+        Q_UNUSED(overwrittenFilesSize)
+        Q_UNUSED(newFilesSize)
+        printf("directories %lld new %lld removed %lld\n",
+               directoriesCount, newDirectories, removedDirectories);
+        printf("files new %lld overwritten %lld removed %lld\n",
+               newFiles, overwrittenFiles, removedFiles);
+    });
+    QObject::connect(&copier, &QThread::finished, &a, &QCoreApplication::quit);
+
+    copier.Setup(arguments[0], arguments[1], true, false);
+    copier.setDurability(Copier::Durability(parser.value(durabilityOption).toInt()));
+    if (parser.isSet(memoryOption)) copier.setMemoryBudget(parser.value(memoryOption).toLongLong());
+    copier.start();
+    a.exec();
+
+    fflush(stdout);
+    return errors == 0 ? 0 : 1;
+}
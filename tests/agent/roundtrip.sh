@@ -0,0 +1,195 @@
+#!/bin/bash
+#
+# *****************************************************************
+#                               SiBa
+# *****************************************************************
+# roundtrip.sh
+#
+# Builds SiBa, siba-agent and agenttest without compiler warnings, then backs up a generated source tree
+# to siba-agent over 127.0.0.1 and over a local socket (siba+unix://)
+# and compares the target tree with the source tree after each run.
+#
+# The first run copies new files and empty directories, a directory
+# of more than 4096 entries is listed in several batches. The second run
+# overwrites, removes and adds files and directories and links a new file
+# to an unchanged multiply-linked file. A sparse file must keep its holes
+# if the file system of the working directory supports them.
+#
+# Environment: QMAKE (default qmake), BUILD (build directory, default temporary),
+# PORT (default 17887), KEEP=1 keeps the working directory.
+#
+# Source: https:\\github.com/milan-koren/SiBa
+# Licence: EUPL v. 1.2
+# *****************************************************************
+
+set -eu
+
+REPO=$(cd "$(dirname "$0")/../.." && pwd)
+QMAKE=${QMAKE:-qmake}
+PORT=${PORT:-17887}
+TOKEN=roundtrip-token
+WORK=$(mktemp -d)
+BUILD=${BUILD:-$WORK/build}
+AGENTPID=
+
+cleanup() {
+    [ -n "$AGENTPID" ] && kill "$AGENTPID" 2>/dev/null || true
+    if [ "${KEEP:-0}" = 1 ]; then echo "kept $WORK"; else rm -rf "$WORK"; fi
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+
+# ---- build
+
+build() {
+    local project=$1 directory=$2 makefile=$3
+    mkdir -p "$directory"
+    (cd "$directory" && "$QMAKE" "$project" && make -f "$makefile" -j"$(nproc)") >"$directory.log" 2>&1 \
+        || { tail -n 50 "$directory.log" >&2; fail "build of $project"; }
+    if grep -i "warning:" "$directory.log" >&2; then fail "build of $project has warnings"; fi
+    return 0
+}
+
+build "$REPO/SiBa.pro" "$BUILD/siba" Makefile
+build "$REPO/siba-agent.pro" "$BUILD/siba-agent" Makefile.siba-agent
+build "$REPO/tests/agent/agenttest.pro" "$BUILD/agenttest" Makefile
+
+AGENT=$BUILD/siba-agent/siba-agent
+COPIER=$BUILD/agenttest/agenttest
+
+
+# ---- source tree
+
+SOURCE=$WORK/source
+mkdir -p "$SOURCE/a/b/c" "$SOURCE/empty" "$SOURCE/large" "$SOURCE/stale/deep"
+touch "$SOURCE/source.siba"
+echo one >"$SOURCE/one.txt"
+echo two >"$SOURCE/a/two.txt"
+echo three >"$SOURCE/a/b/c/three.txt"
+echo stale >"$SOURCE/stale/deep/stale.txt"
+echo removed >"$SOURCE/a/removed.txt"
+head -c 3000000 /dev/urandom >"$SOURCE/a/b/random.bin"
+: >"$SOURCE/zero.txt"
+echo linked >"$SOURCE/a/linked.txt"
+ln "$SOURCE/a/linked.txt" "$SOURCE/a/b/linked.txt"
+for i in $(seq 1 5000); do echo "$i" >"$SOURCE/large/f$i"; done
+truncate -s 64M "$SOURCE/a/image.bin"
+dd if=/dev/urandom of="$SOURCE/a/image.bin" bs=1M count=1 seek=20 conv=notrunc status=none
+SPARSE=0
+[ "$(du -k "$SOURCE/a/image.bin" | cut -f1)" -lt 8192 ] && SPARSE=1
+
+modify_source() {
+    sleep 1
+    echo changed >"$SOURCE/one.txt"
+    head -c 1000000 /dev/urandom >"$SOURCE/a/b/random.bin"
+    rm "$SOURCE/a/removed.txt"
+    rm -r "$SOURCE/stale"
+    mkdir -p "$SOURCE/new/empty"
+    echo new >"$SOURCE/new/new.txt"
+    for i in $(seq 1 2 5000); do rm "$SOURCE/large/f$i"; done
+    echo changed >"$SOURCE/large/f4000"
+    ln "$SOURCE/a/linked.txt" "$SOURCE/a/b/c/linked.txt"
+}
+
+
+# ---- checks
+
+compare() {
+    local target=$1
+    diff -r --no-dereference -x source.siba -x target.siba "$SOURCE" "$target" >"$WORK/diff.txt" \
+        || { head -n 20 "$WORK/diff.txt" >&2; fail "$target differs from source"; }
+    [ "$(stat -c %a "$target/target.siba")" = 644 ] || fail "permissions of target.siba were changed"
+    [ "$(stat -c %i "$target/a/linked.txt")" = "$(stat -c %i "$target/a/b/linked.txt")" ] \
+        || fail "hard link was not recreated in $target"
+    if [ "$SPARSE" = 1 ]; then
+        [ "$(du -k "$target/a/image.bin" | cut -f1)" -lt 8192 ] || fail "holes of sparse file were filled in $target"
+    fi
+}
+
+start_agent() {
+    "$AGENT" "$@" &
+    AGENTPID=$!
+    sleep 1
+    kill -0 "$AGENTPID" 2>/dev/null || fail "siba-agent did not start"
+}
+
+stop_agent() {
+    kill "$AGENTPID"
+    wait "$AGENTPID" 2>/dev/null || true
+    AGENTPID=
+}
+
+new_target() {
+    mkdir -p "$1"
+    touch "$1/target.siba"
+    chmod 644 "$1/target.siba"
+}
+
+backup() {
+    "$COPIER" "$SOURCE" "$1" >"$WORK/copier.log" 2>&1 || { cat "$WORK/copier.log" >&2; fail "backup to $1"; }
+}
+
+
+# ---- siba-agent refuses to start without a token
+
+for options in "--bind 0.0.0.0 --port $PORT" "--bind 127.0.0.1 --port $PORT" "--socket $WORK/siba.sock"; do
+    STATUS=0
+    SIBA_AGENT_TOKEN= timeout 5 "$AGENT" $options "$WORK" >/dev/null 2>&1 || STATUS=$?
+    [ "$STATUS" = 1 ] || fail "siba-agent started without a token: $options"
+done
+
+
+# ---- TCP on 127.0.0.1, new files, then modified tree
+
+TCPTARGET=$WORK/tcp
+new_target "$TCPTARGET"
+start_agent --bind 127.0.0.1 --port "$PORT" --token "$TOKEN" "$TCPTARGET"
+
+backup "siba://$TOKEN@127.0.0.1:$PORT"
+compare "$TCPTARGET"
+echo "tcp: new tree ok"
+
+SIBA_AGENT_TOKEN=wrong "$COPIER" "$SOURCE" "siba://127.0.0.1:$PORT" >/dev/null 2>&1 \
+    && fail "agent accepted an invalid token"
+
+SAVED=$WORK/saved
+cp -a "$SOURCE" "$SAVED"
+modify_source
+backup "siba://$TOKEN@127.0.0.1:$PORT"
+compare "$TCPTARGET"
+# a is listed before its subdirectories, so the unchanged a/linked.txt is known before a/b/c
+[ "$(stat -c %i "$TCPTARGET/a/linked.txt")" = "$(stat -c %i "$TCPTARGET/a/b/c/linked.txt")" ] \
+    || fail "new link to an unchanged file was not recreated"
+echo "tcp: modified tree ok"
+stop_agent
+
+
+# ---- local socket, the same two runs into a new target
+
+rm -rf "$SOURCE"
+mv "$SAVED" "$SOURCE"
+
+UNIXTARGET=$WORK/unix
+new_target "$UNIXTARGET"
+start_agent --socket "$WORK/siba.sock" --token "$TOKEN" "$UNIXTARGET"
+[ "$(stat -c %a "$WORK/siba.sock")" = 700 ] || fail "local socket is accessible by other users"
+export SIBA_AGENT_TOKEN=$TOKEN
+
+backup "siba+unix://$WORK/siba.sock"
+compare "$UNIXTARGET"
+echo "unix: new tree ok"
+
+modify_source
+backup "siba+unix://$WORK/siba.sock"
+compare "$UNIXTARGET"
+[ "$(stat -c %i "$UNIXTARGET/a/linked.txt")" = "$(stat -c %i "$UNIXTARGET/a/b/c/linked.txt")" ] \
+    || fail "new link to an unchanged file was not recreated"
+echo "unix: modified tree ok"
+stop_agent
+
+echo "PASS"